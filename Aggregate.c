@@ -0,0 +1,84 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include "Aggregate.h"
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * New settings keep the window that is open, a reload does not lose its readings
+ * ---------------------------------------------------------------------------------------
+ */
+void aggregate_setup( aggregate_t *state, uint64_t window ) {
+    state->window = window;
+}
+
+bool aggregate_active( const aggregate_t *state ) {
+    return state->window != 0;
+}
+
+void aggregate_feed( aggregate_t *state, uint16_t value, uint64_t now ) {
+    if ( !state->primed ) {
+        state->primed = true;
+        state->start  = now;
+    } else if ( state->last ) {
+        state->high += now - state->time;
+    }
+    if ( state->count == 0 || value < state->min ) {
+        state->min = value;
+    }
+    if ( state->count == 0 || value > state->max ) {
+        state->max = value;
+    }
+    state->sum  += value;
+    state->last  = value;
+    state->time  = now;
+    state->count++;
+}
+
+bool aggregate_due( const aggregate_t *state, uint64_t now ) {
+    return state->primed && now - state->start >= state->window;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Summary of the window that ends now, the next one starts right away and counts the
+ * time until its first reading towards the last value
+ * ---------------------------------------------------------------------------------------
+ */
+void aggregate_close( aggregate_t *state, uint64_t now, aggregate_summary_t *summary ) {
+    if ( state->last ) {
+        state->high += now - state->time;
+    }
+    summary->count = state->count;
+    summary->min   = state->min;
+    summary->max   = state->max;
+    summary->last  = state->last;
+    summary->mean  = state->count ? (state->sum * 1000 + state->count / 2) / state->count : 0;
+    summary->high  = state->high / 1000;
+    summary->span  = (now - state->start) / 1000;
+
+    state->start = now;
+    state->time  = now;
+    state->sum   = 0;
+    state->high  = 0;
+    state->count = 0;
+}
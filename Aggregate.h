@@ -0,0 +1,68 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Aggregate_h
+#define Aggregate_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Summary of the readings of a sensor over a fixed window: min, max, mean, last value,
+ * number of readings and, for digital inputs, how long the input was high. Every reading
+ * is fed in with its time, constant work per reading and no memory besides aggregate_t.
+ * The high time counts the span between two readings towards the level of the first.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint64_t  window;                           /* usec, 0 = not aggregated            */
+    uint64_t  start;                            /* usec, of the current window         */
+    uint64_t  time;                             /* usec, of the last reading           */
+    uint64_t  sum;
+    uint64_t  high;                             /* usec, level was not 0               */
+    uint32_t  count;
+    uint16_t  min;
+    uint16_t  max;
+    uint16_t  last;
+    bool      primed;                           /* last and time are valid             */
+} aggregate_t;
+
+typedef struct {
+    uint32_t  count;
+    uint16_t  min;
+    uint16_t  max;
+    uint16_t  last;
+    uint32_t  mean;                             /* value * 1000                        */
+    uint64_t  high;                             /* msecs                               */
+    uint64_t  span;                             /* msecs the window lasted             */
+} aggregate_summary_t;
+
+void     aggregate_setup( aggregate_t *state, uint64_t window );
+bool     aggregate_active( const aggregate_t *state );
+void     aggregate_feed( aggregate_t *state, uint16_t value, uint64_t now );
+bool     aggregate_due( const aggregate_t *state, uint64_t now );
+void     aggregate_close( aggregate_t *state, uint64_t now, aggregate_summary_t *summary );
+
+#endif /* Aggregate_h */
@@ -20,57 +20,404 @@
  * ---------------------------------------------------------------------------------------
  */
 
+#include <sys/prctl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
 #include "DHT11.h"
+#include "GPIO.h"
+#include "Stats.h"
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Pending acquisitions, one entry per pin at most
+ * ---------------------------------------------------------------------------------------
+ */
+#define DHT11_QUEUE  16
+#define DHT11_PINS   256
+
+typedef struct {
+    uint8_t   pin;
+    uint64_t  requested;
+} dht11_request_t;
+
+static pthread_t        reader;
+static bool             reader_running = false;
+static pthread_mutex_t  queue_lock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   queue_cond;
+static dht11_request_t  queue[DHT11_QUEUE];
+static int              queue_count    = 0;
+static int              result_pipe[2] = { -1, -1 };
+static dht11_stats_t    stats;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Per pin acquisition cache: one physical read serves every logical sensor on the pin
+ * while it is fresh, and no pin is read more often than the sensor allows
+ * ---------------------------------------------------------------------------------------
+ */
+static uint64_t         freshness      = 0;             /* usec                          */
+static uint64_t         min_interval   = 0;             /* usec                          */
+static uint64_t         last_start[DHT11_PINS];
+static dht11_result_t   last_good[DHT11_PINS];
+static uint32_t         pin_failures[DHT11_PINS];
+
+static uint64_t dht11_timestamp( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Decode a recorded DHT11 waveform. edges[] holds the time (usec) of each level change,
+ * 'level' is the line level before the first one. Every bit is sent as ~50us low followed
+ * by ~27us (0) or ~70us (1) high, so only the width of the high pulses matters. The last
+ * 40 complete high pulses are the data bits, anything before them (noise, a missed first
+ * edge) is ignored. The ~80us high of the sensor's response has to come right before
+ * them, else a frame missing its last bits would pass with the response as first bit.
+ * No hardware access, so this can be fed with recorded or synthetic waveforms.
+ * ---------------------------------------------------------------------------------------
+ */
+bool dht11_decode( const uint32_t *edges, int count, uint8_t level, uint8_t data[5] ) {
+    uint32_t width[DHT11_BITS+1];
+    int      pulses = 0;
+
+    for ( int i=0; i+1<count; i++ ) {
+        level = !level;
+        if ( level ) {                                      /* rising edge ...         */
+            if ( pulses == DHT11_BITS+1 ) {                 /* keep the most recent    */
+                memmove(width, width+1, DHT11_BITS*sizeof(uint32_t));
+                pulses--;
+            }
+            width[pulses++] = edges[i+1] - edges[i];        /* ... until next falling  */
+        }
+    }
+    if ( pulses <= DHT11_BITS || width[pulses-DHT11_BITS-1] <= DHT11_ONE_WIDTH ) {
+        return false;
+    }
+
+    memset(data, 0, 5);
+    for ( int bit=0; bit<DHT11_BITS; bit++ ) {
+        data[bit/8] <<= 1;
+        if ( width[pulses-DHT11_BITS+bit] > DHT11_ONE_WIDTH ) {
+            data[bit/8] |= 1;
+        }
+    }
+    return data[4] == ((data[0]+data[1]+data[2]+data[3]) & 0xFF);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Send the start pulse and record the time of every level change on the monotonic
+ * clock until the sensor goes quiet. Returns the number of edges recorded.
+ * ---------------------------------------------------------------------------------------
+ */
+int dht11_capture( uint8_t pin, uint32_t *edges, int max, uint8_t *level ) {
+    uint64_t start, last, now;
+    int      count = 0;
+    int      current;
 
-bool dht11_read_val( uint8_t pin, uint16_t *humidity, uint16_t *celcius ) {
-    uint8_t lststate=HIGH;
-    uint8_t counter=0;
-    uint8_t j=0, i;
-    bool success = false;
-    int dht11_val[5]={0,0,0,0,0};
-    
     pinMode(pin,OUTPUT);
     digitalWrite(pin,LOW);
     delay(18);
     digitalWrite(pin,HIGH);
-    
+
     delayMicroseconds(40);
     pinMode(pin,INPUT);
-    
-    for (i=0;i<MAX_TIME;i++) {
-        counter=0;
-        while(digitalRead(pin)==lststate){
-            counter++;
-            delayMicroseconds(1);
-            if(counter==255) {
+
+    *level  = current = digitalRead(pin);
+    start   = last    = dht11_timestamp();
+
+    while ( count < max ) {
+        int sample = digitalRead(pin);
+        now = dht11_timestamp();
+        if ( sample != current ) {
+            current        = sample;
+            edges[count++] = now - start;
+            last           = now;
+        } else if ( now - last > DHT11_IDLE ) {
+            break;
+        }
+    }
+    return count;
+}
+
+bool dht11_read_val( uint8_t pin, uint16_t *humidity, uint16_t *celcius ) {
+    uint32_t edges[MAX_TIME];
+    uint8_t  data[5];
+    uint8_t  level;
+    int      count;
+
+    if ( gpio_backend() == GPIO_SIM ) {
+        count = gpio_sim_capture(pin, edges, MAX_TIME, &level);
+    } else {
+        count = dht11_capture(pin, edges, MAX_TIME, &level);
+    }
+
+    if ( !dht11_decode(edges, count, level, data) ) {
+        return false;
+    }
+    if ( humidity ) {
+        *humidity = data[0];
+    }
+    if ( celcius ) {
+        *celcius  = data[2];
+    }
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Reader thread main loop: take the next request, run the transaction, hand the result
+ * back through the pipe
+ * ---------------------------------------------------------------------------------------
+ */
+static void *dht11_reader( void *arg ) {
+    sigset_t signals;
+
+    // signals are the main loop's business, also for a reader restarted by a reload
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // the sensor loop's timer slack must not stretch the start signal
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+
+    for ( ;; ) {
+        dht11_request_t request;
+        dht11_result_t  result;
+        uint64_t        start, ready, delay, duration;
+        int             next = -1;
+
+        // wait for a request on a pin that has rested for at least min_interval
+        pthread_mutex_lock(&queue_lock);
+        while ( reader_running ) {
+            uint64_t now = dht11_timestamp(), wakeup = 0;
+
+            for ( int i=0; i<queue_count && next == -1; i++ ) {
+                ready = last_start[queue[i].pin] + min_interval;
+                if ( ready <= now ) {
+                    next = i;
+                } else if ( wakeup == 0 || ready < wakeup ) {
+                    wakeup = ready;
+                }
+            }
+            if ( next != -1 ) {
                 break;
             }
+            if ( wakeup ) {
+                struct timespec ts = { wakeup / 1000000, (wakeup % 1000000) * 1000 };
+                pthread_cond_timedwait(&queue_cond, &queue_lock, &ts);
+            } else {
+                pthread_cond_wait(&queue_cond, &queue_lock);
+            }
         }
-        lststate=digitalRead(pin);
-        if (counter==255) {
+        if ( !reader_running ) {
+            pthread_mutex_unlock(&queue_lock);
             break;
         }
-        
-        // top 3 transistions are ignored
-        if ((i>=4)&&(i%2==0)) {
-            dht11_val[j/8]<<=1;
-            if(counter>16) {
-                dht11_val[j/8]|=1;
-            }
-            j++;
+        request = queue[next];
+        memmove(&queue[next], &queue[next+1], (queue_count-next-1)*sizeof(dht11_request_t));
+        queue_count--;
+
+        start = dht11_timestamp();
+        ready = last_start[request.pin] + min_interval;
+        if ( ready > request.requested ) {
+            stats.deferred++;
+        } else {
+            ready = request.requested;
         }
-    }
-    
-    // verify cheksum and print the verified data
-    if( (j>=40) && (dht11_val[4]==((dht11_val[0]+dht11_val[1]+dht11_val[2]+dht11_val[3]) & 0xFF))) {
-        if ( humidity ) {
-            *humidity = dht11_val[0];
+        last_start[request.pin] = start;
+        pthread_mutex_unlock(&queue_lock);
+
+        memset(&result, 0, sizeof(result));
+        result.pin       = request.pin;
+        result.success   = dht11_read_val(request.pin, &result.humidity, &result.celcius);
+        result.timestamp = dht11_timestamp();
+
+        delay    = start - ready;
+        duration = result.timestamp - start;
+        result.duration = duration;
+        stats_record(STATS_READ_DHT11, duration);
+
+        pthread_mutex_lock(&queue_lock);
+        stats.reads++;
+        if ( result.success ) {
+            last_good[result.pin] = result;
+        } else {
+            stats.failures++;
+            pin_failures[result.pin]++;
+        }
+        stats.delay_sum += delay;
+        if ( stats.reads == 1 || delay < stats.delay_min ) {
+            stats.delay_min = delay;
+        }
+        if ( delay > stats.delay_max ) {
+            stats.delay_max = delay;
         }
-        if ( celcius ) {
-            *celcius  = dht11_val[2];
+        if ( duration > stats.duration_max ) {
+            stats.duration_max = duration;
         }
-        success = true;
+        pthread_mutex_unlock(&queue_lock);
+
+        // a slow main loop must not stall this thread, the reading is dropped instead
+        if ( write(result_pipe[1], &result, sizeof(result)) != sizeof(result) ) {
+            fprintf(stderr, "Error: DHT11 result pipe full, reading of pin %d lost\n", result.pin);
+            pthread_mutex_lock(&queue_lock);
+            stats.dropped++;
+            pthread_mutex_unlock(&queue_lock);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Start the reader thread, with real-time priority if we are allowed to. Results younger
+ * than 'fresh' msecs are served from the cache, a pin is read at most every 'interval'
+ * msecs.
+ * ---------------------------------------------------------------------------------------
+ */
+bool dht11_reader_start( int priority, uint32_t fresh, uint32_t interval ) {
+    pthread_attr_t     attr;
+    pthread_condattr_t cond_attr;
+    struct sched_param param;
+    int                err;
+
+    if ( reader_running ) {
+        return true;
+    }
+    if ( pipe(result_pipe) == -1 ) {
+        fprintf(stderr, "Error: pipe [%s]\n", strerror(errno));
+        return false;
     }
-    
-    return success;
+    fcntl(result_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(result_pipe[1], F_SETFL, O_NONBLOCK);
+    memset(&stats,      0, sizeof(stats));
+    memset(last_start,  0, sizeof(last_start));
+    memset(last_good,   0, sizeof(last_good));
+    memset(pin_failures, 0, sizeof(pin_failures));
+    freshness      = (uint64_t)fresh    * 1000;
+    min_interval   = (uint64_t)interval * 1000;
+    reader_running = true;
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = priority;
+    pthread_attr_setschedparam(&attr, &param);
+
+    err = pthread_create(&reader, &attr, dht11_reader, NULL);
+    if ( err == EPERM ) {
+        fprintf(stderr, "Warning: no permission for SCHED_FIFO, DHT11 reader runs at normal priority\n");
+        err = pthread_create(&reader, NULL, dht11_reader, NULL);
+    }
+    pthread_attr_destroy(&attr);
+
+    if ( err ) {
+        fprintf(stderr, "Error: DHT11 reader thread [%s]\n", strerror(err));
+        reader_running = false;
+        pthread_cond_destroy(&queue_cond);
+        close(result_pipe[0]);
+        close(result_pipe[1]);
+        result_pipe[0] = result_pipe[1] = -1;
+        return false;
+    }
+    return true;
+}
+
+void dht11_reader_stop( void ) {
+    if ( !reader_running ) {
+        return;
+    }
+    pthread_mutex_lock(&queue_lock);
+    reader_running = false;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(reader, NULL);
+    pthread_cond_destroy(&queue_cond);
+
+    close(result_pipe[0]);
+    close(result_pipe[1]);
+    result_pipe[0] = result_pipe[1] = -1;
+    queue_count = 0;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Queue an acquisition for pin. A fresh cached result is copied to 'cached' right away
+ * (the caller is the pipe's only reader, writing it there could block on itself), a
+ * request already pending for the same pin is reused.
+ * ---------------------------------------------------------------------------------------
+ */
+dht11_status_t dht11_request( uint8_t pin, dht11_result_t *cached ) {
+    dht11_status_t status = DHT11_QUEUED;
+    uint64_t       now    = dht11_timestamp();
+
+    pthread_mutex_lock(&queue_lock);
+    if ( last_good[pin].timestamp && now - last_good[pin].timestamp <= freshness ) {
+        *cached = last_good[pin];
+        stats.cache_hits++;
+        pthread_mutex_unlock(&queue_lock);
+        return DHT11_CACHED;
+    }
+    for ( int i=0; i<queue_count; i++ ) {
+        if ( queue[i].pin == pin ) {
+            pthread_mutex_unlock(&queue_lock);
+            return DHT11_QUEUED;
+        }
+    }
+    if ( !reader_running || queue_count == DHT11_QUEUE ) {
+        stats.dropped++;
+        status = DHT11_FULL;
+    } else {
+        dht11_request_t *request = &queue[queue_count];
+        request->pin       = pin;
+        request->requested = now;
+        queue_count++;
+        stats.requests++;
+        pthread_cond_signal(&queue_cond);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return status;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Collect the next finished acquisition without blocking
+ * ---------------------------------------------------------------------------------------
+ */
+bool dht11_result( dht11_result_t *result ) {
+    if ( result_pipe[0] == -1 ) {
+        return false;
+    }
+    return read(result_pipe[0], result, sizeof(*result)) == sizeof(*result);
+}
+
+int dht11_result_fd( void ) {
+    return result_pipe[0];
+}
+
+void dht11_reader_stats( dht11_stats_t *copy ) {
+    pthread_mutex_lock(&queue_lock);
+    *copy = stats;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/*
+ * transactions on pin without valid checksum, a single word needs no lock
+ */
+uint32_t dht11_failures( uint8_t pin ) {
+    return pin_failures[pin];
 }
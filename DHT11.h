@@ -30,8 +30,56 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define MAX_TIME  85
+#define MAX_TIME         85             /* max. number of edges recorded per read   */
+#define DHT11_BITS       40
+#define DHT11_ONE_WIDTH  48             /* usec, longer high pulses are a '1' bit   */
+#define DHT11_IDLE       200            /* usec without edge ends the transaction   */
+#define DHT11_INTERVAL   1000           /* msec the sensor needs between two reads  */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Reader thread: DHT11 transactions are bit-banged on a dedicated (SCHED_FIFO if
+ * permitted) thread. Requests are queued with dht11_request(), results are written to
+ * a pipe, dht11_result_fd() becomes readable when there is something to collect.
+ * Each pin is read at most once per interval, a fresh result is reused for all
+ * requests on the pin (e.g. DHT11_TMP and DHT11_HMD sharing one sensor) and handed
+ * straight back by dht11_request(), it does not go through the pipe.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint8_t   pin;
+    bool      success;
+    uint16_t  humidity;
+    uint16_t  celcius;
+    uint32_t  duration;                     /* usec the transaction took                 */
+    uint64_t  timestamp;                    /* usec, CLOCK_MONOTONIC, end of transaction */
+} dht11_result_t;
+
+typedef enum { DHT11_QUEUED, DHT11_CACHED, DHT11_FULL } dht11_status_t;
+
+typedef struct {
+    uint32_t  requests;                     /* accepted requests                         */
+    uint32_t  dropped;                      /* requests/results lost, queue/pipe full    */
+    uint32_t  reads;                        /* transactions run                          */
+    uint32_t  failures;                     /* transactions without valid checksum       */
+    uint32_t  cache_hits;                   /* requests served from the per pin cache    */
+    uint32_t  deferred;                     /* reads delayed by the minimum interval     */
+    uint64_t  delay_sum;                    /* usec request queued -> transaction start  */
+    uint64_t  delay_min;
+    uint64_t  delay_max;
+    uint64_t  duration_max;                 /* usec longest transaction                  */
+} dht11_stats_t;
 
 bool dht11_read_val( uint8_t pin, uint16_t *humidity, uint16_t *celcius );
+int  dht11_capture( uint8_t pin, uint32_t *edges, int max, uint8_t *level );
+bool dht11_decode( const uint32_t *edges, int count, uint8_t level, uint8_t data[5] );
+
+bool dht11_reader_start( int priority, uint32_t fresh, uint32_t interval );
+void dht11_reader_stop( void );
+dht11_status_t dht11_request( uint8_t pin, dht11_result_t *cached );
+bool dht11_result( dht11_result_t *result );
+int  dht11_result_fd( void );
+void dht11_reader_stats( dht11_stats_t *stats );
+uint32_t dht11_failures( uint8_t pin );
 
 #endif /* DHT11_h */
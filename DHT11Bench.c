@@ -0,0 +1,162 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * DHT11 decoder check and benchmark: synthetic waveforms, timed like the sensor sends
+ * them, through dht11_decode(). Each case states whether the frame must decode and to
+ * what, and reports the decode time in nsecs:
+ *   good         clean frame, jitter on every pulse, first edge missed, noise before it
+ *   checksum     a data bit flipped on the way, a wrong checksum byte
+ *   short        frame cut off before the last bits, no answer at all
+ * Exits with a failure if any case does not decode as expected.
+ * ---------------------------------------------------------------------------------------
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "DHT11.h"
+
+#define BENCH_ROUNDS  (1024*1024)               /* decodes per measurement             */
+#define BENCH_EDGES   100                       /* room for a frame and some noise     */
+
+typedef struct {
+    const char *name;
+    uint8_t    data[5];                         /* as sent, checksum included          */
+    int        jitter;                          /* usec, +/- on every pulse            */
+    int        noise;                           /* short pulses before the response    */
+    int        skip;                            /* edges missed at the start           */
+    int        bits;                            /* bits sent before the line goes idle */
+    bool       good;                            /* must decode to data                 */
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+    { "good",            { 48, 0, 21, 0,  69 }, 0,  0, 0, 40, true  },
+    { "good, jitter",    { 48, 0, 21, 0,  69 }, 12, 0, 0, 40, true  },
+    { "good, no edge 1", { 48, 0, 21, 0,  69 }, 5,  0, 1, 40, true  },
+    { "good, noise",     { 35, 0, 19, 0,  54 }, 5,  4, 0, 40, true  },
+    { "good, all ones",  { 255, 255, 255, 255, 252 }, 5, 0, 0, 40, true  },
+    { "checksum, bit",   { 48, 0, 29, 0,  69 }, 5,  0, 0, 40, false },
+    { "checksum, byte",  { 48, 0, 21, 0,  70 }, 5,  0, 0, 40, false },
+    { "short, 39 bits",  { 48, 0, 21, 0,  69 }, 5,  0, 0, 39, false },
+    { "short, 20 bits",  { 48, 0, 21, 0,  69 }, 5,  0, 0, 20, false },
+    { "short, silent",   { 48, 0, 21, 0,  69 }, 0,  0, 0, -1, false },
+};
+
+volatile uint64_t sink;                         /* keeps results from being optimized  */
+
+uint64_t bench_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * The waveform of one case: noise, 80us low and 80us high response, then per bit 50us low
+ * and 27us (0) or 70us (1) high, 50us low at the end. Returns the number of edges.
+ * ---------------------------------------------------------------------------------------
+ */
+static void edge( uint32_t *edges, int *count, uint32_t *now, int width, int jitter, unsigned int *seed ) {
+    if ( *count < BENCH_EDGES ) {
+        edges[(*count)++] = *now;
+    }
+    if ( jitter ) {
+        width += rand_r(seed) % (2*jitter+1) - jitter;
+    }
+    *now += (width > 1) ? width : 1;
+}
+
+int makeFrame( const bench_case_t *frame, uint32_t *edges, uint8_t *level ) {
+    unsigned int seed  = 1;
+    uint32_t     now   = 20;
+    int          count = 0;
+
+    *level = 1;
+    if ( frame->bits < 0 ) {
+        return 0;
+    }
+    for ( int i=0; i<frame->noise; i++ ) {
+        edge(edges, &count, &now, 3, 0, &seed);
+        edge(edges, &count, &now, 4, 0, &seed);
+    }
+    edge(edges, &count, &now, 80, frame->jitter, &seed);
+    edge(edges, &count, &now, 80, frame->jitter, &seed);
+    for ( int bit=0; bit<frame->bits; bit++ ) {
+        edge(edges, &count, &now, 50, frame->jitter, &seed);
+        edge(edges, &count, &now, (frame->data[bit/8] & (0x80 >> bit%8)) ? 70 : 27, frame->jitter, &seed);
+    }
+    edge(edges, &count, &now, 50, frame->jitter, &seed);
+    edge(edges, &count, &now, 0, 0, &seed);
+
+    // a missed edge leaves the level of the one before
+    count -= frame->skip;
+    memmove(edges, edges + frame->skip, count * sizeof(uint32_t));
+    if ( frame->skip & 1 ) {
+        *level = !*level;
+    }
+    return count;
+}
+
+bool runCase( const bench_case_t *frame ) {
+    uint32_t edges[BENCH_EDGES];
+    uint8_t  data[5], level;
+    int      count = makeFrame(frame, edges, &level);
+    bool     good  = dht11_decode(edges, count, level, data);
+    bool     ok    = (good == frame->good) && (!good || !memcmp(data, frame->data, 5));
+    uint64_t start;
+    double   nsecs;
+
+    start = bench_timestamp();
+    for ( int round=0; round<BENCH_ROUNDS; round++ ) {
+        sink += dht11_decode(edges, count, level, data);
+    }
+    nsecs = (double)(bench_timestamp() - start) / BENCH_ROUNDS;
+
+    printf("%-16s %5d %8s %8s %8.1f  %s\n", frame->name, count,
+           frame->good ? "good" : "bad", good ? "good" : "bad", nsecs, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * M A I N
+ * ---------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[]) {
+    int failed = 0;
+
+    printf("%-16s %5s %8s %8s %8s\n", "frame", "edges", "expected", "decoded", "ns");
+    for ( size_t i=0; i<sizeof(cases)/sizeof(cases[0]); i++ ) {
+        failed += !runCase(&cases[i]);
+    }
+    if ( failed ) {
+        printf("%d frames not decoded as expected\n", failed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
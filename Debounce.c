@@ -0,0 +1,91 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include "Debounce.h"
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * New settings keep the state, so a reload does not report the current level again
+ * ---------------------------------------------------------------------------------------
+ */
+void debounce_setup( debounce_t *state, uint32_t stable, uint16_t max_flips ) {
+    state->stable    = stable;
+    state->max_flips = max_flips;
+}
+
+bool debounce_active( const debounce_t *state ) {
+    return state->stable || state->max_flips;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Feed the current level, returns the level to report. If a change is pending *recheck
+ * is set to the time it could be taken over, the caller has to feed the level again then
+ * (or earlier), nothing happens in between.
+ * ---------------------------------------------------------------------------------------
+ */
+uint8_t debounce_feed( debounce_t *state, uint8_t level, uint64_t now, uint64_t *recheck ) {
+    *recheck = 0;
+    if ( !state->primed ) {
+        state->primed = true;
+        state->level  = level;
+        state->value  = level;
+        state->since  = now;
+        state->window = now;
+        return level;
+    }
+
+    if ( level != state->level ) {
+        // a pending change went back before it was reported
+        if ( level == state->value ) {
+            state->suppressed++;
+            state->holding = false;
+        }
+        state->level = level;
+        state->since = now;
+    }
+    if ( state->level == state->value ) {
+        return state->value;
+    }
+
+    if ( now - state->since < state->stable ) {
+        *recheck = state->since + state->stable;
+        return state->value;
+    }
+    if ( now - state->window >= DEBOUNCE_WINDOW ) {
+        state->window = now;
+        state->flips  = 0;
+    }
+    if ( state->max_flips && state->flips >= state->max_flips ) {
+        if ( !state->holding ) {
+            state->holding = true;
+            state->held++;
+        }
+        *recheck = state->window + DEBOUNCE_WINDOW;
+        return state->value;
+    }
+
+    state->flips++;
+    state->holding = false;
+    state->value   = state->level;
+    return state->value;
+}
@@ -0,0 +1,60 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Debounce_h
+#define Debounce_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Software debouncing of a digital input. Every level seen (read or from an edge event)
+ * is fed in with its time, what comes out is the level to report: a change is only
+ * taken over once the input has kept it for 'stable' usecs, and no more than
+ * 'max_flips' changes per second are taken over, later ones wait for the next second.
+ * A change that goes away again before it was taken over counts as suppressed.
+ * ---------------------------------------------------------------------------------------
+ */
+#define DEBOUNCE_WINDOW  1000000                /* usec, max_flips are per window      */
+
+typedef struct {
+    uint32_t  stable;                           /* usec, 0 = take changes right away   */
+    uint16_t  max_flips;                        /* per second, 0 = no limit            */
+    uint16_t  flips;                            /* taken over in the current window    */
+    uint64_t  window;                           /* usec, start of the current window   */
+    uint64_t  since;                            /* usec, input has 'level' since then  */
+    uint8_t   level;                            /* last level fed in                   */
+    uint8_t   value;                            /* level reported                      */
+    bool      primed;                           /* value is valid                      */
+    bool      holding;                          /* change waits for the flip limit     */
+    uint32_t  suppressed;                       /* changes that never got reported     */
+    uint32_t  held;                             /* changes delayed by the flip limit   */
+} debounce_t;
+
+void     debounce_setup( debounce_t *state, uint32_t stable, uint16_t max_flips );
+bool     debounce_active( const debounce_t *state );
+uint8_t  debounce_feed( debounce_t *state, uint8_t level, uint64_t now, uint64_t *recheck );
+
+#endif /* Debounce_h */
@@ -0,0 +1,698 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/gpio.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <wiringPi.h>
+
+#include "GPIO.h"
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * The BCM2835 family has 54 GPIO lines, simulated pins cover the full uint8_t range
+ * ---------------------------------------------------------------------------------------
+ */
+#define MAX_WATCHES  64
+#define SIM_PINS     256
+
+static gpio_backend_t backend     = GPIO_WIRINGPI;
+static const char     *chip_path  = NULL;
+static int            chip_fd     = -1;
+
+static struct pollfd  watch_fds[MAX_WATCHES];
+static uint8_t        watch_pins[MAX_WATCHES];
+static bool           watch_wake[MAX_WATCHES];
+static bool           watch_v2[MAX_WATCHES];        /* events as gpio_v2_line_event    */
+static uint32_t       line_debounce[SIM_PINS];      /* usec, asked of the kernel       */
+static int            num_watches = 0;
+static int            next_watch  = 0;
+
+static int            bank_fd     = -1;         /* line handle for gpio_read_bank()    */
+static uint8_t        bank_pins[GPIO_BANK_MAX];
+static int            bank_count  = 0;
+
+static int            sim_fd      = -1;
+static int            sim_wfd     = -1;
+static uint8_t        sim_level[SIM_PINS];
+static bool           sim_watched[SIM_PINS];
+static char           sim_buffer[256];
+static size_t         sim_fill    = 0;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Scripted simulation: a pin with a period toggles by itself, its level is a function of
+ * the time since sim_epoch so every process sharing the epoch agrees on when each edge
+ * happened. 'noise' is the chance in percent that a read returns the wrong level.
+ * DHT11 pins answer each transaction with a synthetic waveform, 'fail' percent of them
+ * are damaged (flipped bit or cut short), pulse widths vary by up to +/- 'jitter' usec.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint8_t   humidity;
+    uint8_t   celcius;
+    uint8_t   fail;                                 /* percent                         */
+    uint16_t  jitter;                               /* usec                            */
+} sim_dht_t;
+
+static uint64_t       sim_epoch   = 0;
+static uint64_t       sim_period[SIM_PINS];         /* usec, 0 = not scripted          */
+static uint64_t       sim_phase[SIM_PINS];          /* usec                            */
+static uint8_t        sim_noise[SIM_PINS];          /* percent                         */
+static sim_dht_t      sim_dht[SIM_PINS];
+static bool           sim_has_dht[SIM_PINS];
+static uint8_t        sim_scripted[SIM_PINS];       /* watched pins with a period      */
+static int            num_scripted = 0;
+static int            next_scripted = 0;
+static unsigned int   sim_seed    = 1;
+
+uint64_t gpio_timestamp( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+bool gpio_init( gpio_backend_t type, const char *chip, const char *fifo ) {
+    bool success = true;
+
+    backend   = type;
+    chip_path = chip;
+
+    if ( backend == GPIO_SIM ) {
+        if ( sim_epoch == 0 ) {
+            sim_epoch = gpio_timestamp();
+        }
+        if ( fifo ) {
+            // open read/write so the FIFO never reports EOF when a writer goes away
+            if ( mkfifo(fifo, 0600) == -1 && errno != EEXIST ) {
+                fprintf(stderr, "Error: mkfifo %s [%s]\n", fifo, strerror(errno));
+                success = false;
+            } else if ( (sim_fd = open(fifo, O_RDWR|O_NONBLOCK)) == -1 ) {
+                fprintf(stderr, "Error: open %s [%s]\n", fifo, strerror(errno));
+                success = false;
+            }
+            sim_wfd = sim_fd;
+        } else {
+            int fds[2];
+            if ( pipe(fds) == -1 ) {
+                fprintf(stderr, "Error: pipe [%s]\n", strerror(errno));
+                success = false;
+            } else {
+                sim_fd  = fds[0];
+                sim_wfd = fds[1];
+                fcntl(sim_fd,  F_SETFL, O_NONBLOCK);
+                fcntl(sim_wfd, F_SETFL, O_NONBLOCK);
+            }
+        }
+        if ( success ) {
+            watch_fds[0].fd     = sim_fd;
+            watch_fds[0].events = POLLIN;
+            watch_wake[0]       = false;
+            num_watches         = 1;
+        }
+    } else if ( wiringPiSetup() == -1 ) {
+        fprintf(stderr, "Error: wiringPiSetup failed\n");
+        success = false;
+    }
+    return success;
+}
+
+void gpio_end( void ) {
+    gpio_bank(NULL, 0);
+    if ( backend == GPIO_SIM ) {
+        if ( sim_wfd != sim_fd ) {
+            close(sim_wfd);
+        }
+        close(sim_fd);
+        sim_fd = sim_wfd = -1;
+    } else {
+        for ( int i=0; i<num_watches; i++ ) {
+            if ( !watch_wake[i] ) {
+                close(watch_fds[i].fd);
+            }
+        }
+        if ( chip_fd != -1 ) {
+            close(chip_fd);
+            chip_fd = -1;
+        }
+    }
+    num_watches = 0;
+}
+
+gpio_backend_t gpio_backend( void ) {
+    return backend;
+}
+
+void gpio_input( uint8_t pin ) {
+    if ( backend == GPIO_WIRINGPI ) {
+        pinMode(pin, INPUT);
+    }
+}
+
+/*
+ * scripted level of a simulated pin, 'changed' is set to the time of the last edge
+ */
+static uint8_t sim_script_level( uint8_t pin, uint64_t now, uint64_t *changed ) {
+    uint64_t start = sim_epoch + sim_phase[pin];
+    uint64_t cycle;
+
+    if ( now < start ) {
+        *changed = 0;
+        return 0;
+    }
+    cycle    = (now - start) / sim_period[pin];
+    *changed = start + cycle * sim_period[pin];
+    return cycle & 1;
+}
+
+int gpio_read( uint8_t pin ) {
+    if ( backend == GPIO_SIM ) {
+        uint8_t level = sim_level[pin];
+        if ( sim_period[pin] ) {
+            uint64_t changed;
+            level = sim_script_level(pin, gpio_timestamp(), &changed);
+        }
+        if ( sim_noise[pin] && (unsigned)rand_r(&sim_seed) % 100 < sim_noise[pin] ) {
+            level = !level;
+        }
+        return level;
+    }
+    return digitalRead(pin);
+}
+
+static bool open_chip( void ) {
+    if ( chip_fd == -1 && chip_path ) {
+        chip_fd = open(chip_path, O_RDONLY);
+        if ( chip_fd == -1 ) {
+            fprintf(stderr, "Error: open %s [%s]\n", chip_path, strerror(errno));
+        }
+    }
+    return chip_fd != -1;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Have the kernel debounce the edges of a pin, takes effect with the next gpio_watch()
+ * that actually requests the line. gpio_debounced() tells whether it did: that needs the
+ * v2 GPIO character device API, simulated pins are never debounced by the "kernel".
+ * ---------------------------------------------------------------------------------------
+ */
+void gpio_debounce( uint8_t pin, uint32_t usecs ) {
+    line_debounce[pin] = usecs;
+}
+
+bool gpio_debounced( uint8_t pin ) {
+    for ( int i=0; i<num_watches; i++ ) {
+        if ( !watch_wake[i] && watch_pins[i] == pin ) {
+            return watch_v2[i];
+        }
+    }
+    return false;
+}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+static int watch_debounced( uint8_t pin ) {
+    struct gpio_v2_line_request req;
+
+    memset(&req, 0, sizeof(req));
+    req.offsets[0]   = wpiPinToGpio(pin);
+    req.num_lines    = 1;
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    req.config.num_attrs = 1;
+    req.config.attrs[0].mask    = 1;
+    req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+    req.config.attrs[0].attr.debounce_period_us = line_debounce[pin];
+    strncpy(req.consumer, "rpisensorclient", sizeof(req.consumer)-1);
+
+    if ( ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req) == -1 ) {
+        fprintf(stderr, "Error: debounced line request for pin %d [%s]\n", pin, strerror(errno));
+        return -1;
+    }
+    return req.fd;
+}
+#endif
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Request edge events for a pin. On real hardware this uses the GPIO character device,
+ * so the kernel timestamps each edge and queues it until we get around to reading it.
+ * Watching a pin that is already watched is fine, the line can only be requested once.
+ * ---------------------------------------------------------------------------------------
+ */
+bool gpio_watch( uint8_t pin ) {
+    struct gpioevent_request req;
+    int fd = -1;
+
+    if ( backend == GPIO_SIM ) {
+        if ( sim_period[pin] && !sim_watched[pin] ) {
+            sim_scripted[num_scripted++] = pin;
+        }
+        sim_watched[pin] = true;
+        return true;
+    }
+
+    for ( int i=0; i<num_watches; i++ ) {
+        if ( !watch_wake[i] && watch_pins[i] == pin ) {
+            return true;
+        }
+    }
+    if ( num_watches >= MAX_WATCHES || !open_chip() ) {
+        return false;
+    }
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    if ( line_debounce[pin] ) {
+        fd = watch_debounced(pin);
+    }
+#endif
+    watch_v2[num_watches] = (fd != -1);
+    if ( fd == -1 ) {
+        memset(&req, 0, sizeof(req));
+        req.lineoffset  = wpiPinToGpio(pin);
+        req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+        req.eventflags  = GPIOEVENT_REQUEST_BOTH_EDGES;
+        strncpy(req.consumer_label, "rpisensorclient", sizeof(req.consumer_label)-1);
+
+        if ( ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req) == -1 ) {
+            fprintf(stderr, "Error: line event request for pin %d [%s]\n", pin, strerror(errno));
+            return false;
+        }
+        fd = req.fd;
+    }
+    watch_fds[num_watches].fd     = fd;
+    watch_fds[num_watches].events = POLLIN;
+    watch_pins[num_watches]       = pin;
+    watch_wake[num_watches]       = false;
+    num_watches++;
+
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Read several lines in one go. gpio_bank() sets the pins (at most GPIO_BANK_MAX, pins
+ * watched for edge events can't be part of it), gpio_read_bank() returns their levels
+ * with bit n for pins[n]. On real hardware all lines are requested as one handle of the
+ * GPIO character device, so a read is a single ioctl however many lines there are.
+ * Without the character device the lines are read one by one. gpio_bank(NULL, 0)
+ * releases the lines.
+ * ---------------------------------------------------------------------------------------
+ */
+bool gpio_bank( const uint8_t *pins, int count ) {
+    struct gpiohandle_request req;
+
+    if ( bank_fd != -1 ) {
+        close(bank_fd);
+        bank_fd = -1;
+    }
+    if ( count > GPIO_BANK_MAX ) {
+        bank_count = 0;
+        return false;
+    }
+    bank_count = count;
+    if ( count ) {
+        memcpy(bank_pins, pins, count);
+    }
+    if ( backend == GPIO_SIM || count == 0 || !open_chip() ) {
+        return true;
+    }
+
+    memset(&req, 0, sizeof(req));
+    for ( int i=0; i<count; i++ ) {
+        req.lineoffsets[i] = wpiPinToGpio(pins[i]);
+    }
+    req.lines = count;
+    req.flags = GPIOHANDLE_REQUEST_INPUT;
+    strncpy(req.consumer_label, "rpisensorclient", sizeof(req.consumer_label)-1);
+    if ( ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req) == -1 ) {
+        fprintf(stderr, "Error: line handle request for %d lines [%s], reading them one by one\n",
+                count, strerror(errno));
+        return true;
+    }
+    bank_fd = req.fd;
+    return true;
+}
+
+uint64_t gpio_read_bank( void ) {
+    uint64_t levels = 0;
+
+    if ( bank_fd != -1 ) {
+        struct gpiohandle_data data;
+
+        if ( ioctl(bank_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) == 0 ) {
+            for ( int i=0; i<bank_count; i++ ) {
+                levels |= (uint64_t)(data.values[i] != 0) << i;
+            }
+            return levels;
+        }
+    }
+    for ( int i=0; i<bank_count; i++ ) {
+        levels |= (uint64_t)(gpio_read(bank_pins[i]) != 0) << i;
+    }
+    return levels;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Have gpio_wait() return early whenever fd becomes readable. The fd is not read here,
+ * draining it is up to the owner.
+ * ---------------------------------------------------------------------------------------
+ */
+bool gpio_wake_on( int fd ) {
+    if ( num_watches >= MAX_WATCHES || fd == -1 ) {
+        return false;
+    }
+    watch_fds[num_watches].fd     = fd;
+    watch_fds[num_watches].events = POLLIN;
+    watch_wake[num_watches]       = true;
+    watch_v2[num_watches]         = false;
+    num_watches++;
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * For an external event loop: the fds that deliver edge events (wake fds excluded) and
+ * when the next scripted simulated edge is due, (uint64_t)-1 if none. Whenever one of
+ * the fds is readable or that time has come, gpio_wait(0, ...) returns the events.
+ * ---------------------------------------------------------------------------------------
+ */
+int gpio_fds( int *fds, int max ) {
+    int count = 0;
+
+    for ( int i=0; i<num_watches && count<max; i++ ) {
+        if ( !watch_wake[i] ) {
+            fds[count++] = watch_fds[i].fd;
+        }
+    }
+    return count;
+}
+
+uint64_t gpio_next_event( void ) {
+    uint64_t now  = gpio_timestamp();
+    uint64_t next = (uint64_t)-1;
+
+    for ( int n=0; n<num_scripted; n++ ) {
+        uint8_t  pin = sim_scripted[n];
+        uint64_t changed;
+
+        if ( sim_script_level(pin, now, &changed) != sim_level[pin] ) {
+            return now;                                     /* not delivered yet       */
+        }
+        changed = changed ? changed + sim_period[pin] : sim_epoch + sim_phase[pin] + sim_period[pin];
+        if ( changed < next ) {
+            next = changed;
+        }
+    }
+    return next;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Inject an edge into the simulated backend, it is delivered through gpio_wait() exactly
+ * like a hardware event would be.
+ * ---------------------------------------------------------------------------------------
+ */
+void gpio_sim_set( uint8_t pin, uint8_t value ) {
+    char line[48];
+    int  length = sprintf(line, "%d %d %llu\n", pin, value ? 1 : 0,
+                          (unsigned long long)gpio_timestamp());
+    if ( write(sim_wfd, line, length) != length ) {
+        fprintf(stderr, "Error: simulated GPIO pipe full\n");
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Script the simulated backend, may be called before gpio_init(). Times are in usec on
+ * the CLOCK_MONOTONIC scale of gpio_timestamp(), the epoch defaults to gpio_init() time.
+ * ---------------------------------------------------------------------------------------
+ */
+void gpio_sim_epoch( uint64_t epoch ) {
+    sim_epoch = epoch;
+}
+
+void gpio_sim_toggle( uint8_t pin, uint64_t period, uint64_t phase, uint8_t noise ) {
+    sim_period[pin] = period;
+    sim_phase[pin]  = phase;
+    sim_noise[pin]  = (noise > 100) ? 100 : noise;
+}
+
+void gpio_sim_dht( uint8_t pin, uint8_t humidity, uint8_t celcius, uint8_t fail, uint16_t jitter ) {
+    sim_dht[pin].humidity = humidity;
+    sim_dht[pin].celcius  = celcius;
+    sim_dht[pin].fail     = (fail > 100) ? 100 : fail;
+    sim_dht[pin].jitter   = jitter;
+    sim_has_dht[pin]      = true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Simulated DHT11 transaction, same contract as dht11_capture(): takes as long as the real
+ * thing and records the waveform the sensor would send, edges in usec relative to the
+ * end of the start pulse. A pin without a script does not answer at all.
+ * ---------------------------------------------------------------------------------------
+ */
+static void sim_edge( uint32_t *edges, int *count, int max, uint32_t *now,
+                      int width, int jitter, unsigned int *seed ) {
+    if ( *count < max ) {
+        edges[(*count)++] = *now;
+    }
+    if ( jitter ) {
+        width += rand_r(seed) % (2*jitter+1) - jitter;
+    }
+    *now += (width > 1) ? width : 1;
+}
+
+int gpio_sim_capture( uint8_t pin, uint32_t *edges, int max, uint8_t *level ) {
+    static unsigned int seed = 2;                   /* only the DHT11 reader gets here */
+    struct timespec     pause = { 0, 22 * 1000000 };/* start pulse plus transmission   */
+    sim_dht_t           *dht  = &sim_dht[pin];
+    uint8_t             data[5];
+    uint32_t            now   = 20;
+    int                 count = 0;
+
+    nanosleep(&pause, NULL);
+    *level = 1;
+    if ( !sim_has_dht[pin] ) {
+        return 0;
+    }
+
+    data[0] = dht->humidity;
+    data[1] = 0;
+    data[2] = dht->celcius;
+    data[3] = 0;
+    data[4] = data[0] + data[2];
+    if ( dht->fail && (unsigned)rand_r(&seed) % 100 < dht->fail ) {
+        if ( rand_r(&seed) & 1 ) {
+            data[rand_r(&seed) % 5] ^= 1 << (rand_r(&seed) % 8);
+        } else {
+            max = rand_r(&seed) % max;
+        }
+    }
+
+    // response: 80us low, 80us high, then per bit 50us low and 27us (0) or 70us (1) high
+    sim_edge(edges, &count, max, &now, 80, dht->jitter, &seed);
+    sim_edge(edges, &count, max, &now, 80, dht->jitter, &seed);
+    for ( int bit=0; bit<40; bit++ ) {
+        sim_edge(edges, &count, max, &now, 50, dht->jitter, &seed);
+        sim_edge(edges, &count, max, &now, (data[bit/8] & (0x80 >> bit%8)) ? 70 : 27, dht->jitter, &seed);
+    }
+    sim_edge(edges, &count, max, &now, 50, dht->jitter, &seed);
+    sim_edge(edges, &count, max, &now, 0,  0, &seed);    /* sensor releases the line    */
+    return count;
+}
+
+/*
+ * parse one "<pin> <value> [<timestamp>]" line from the simulation buffer
+ */
+static int sim_next_event( gpio_event_t *event ) {
+    char *eol;
+
+    while ( (eol = memchr(sim_buffer, '\n', sim_fill)) ) {
+        unsigned int pin = 0, value = 0;
+        unsigned long long timestamp = 0;
+        int fields;
+
+        *eol   = '\0';
+        fields = sscanf(sim_buffer, "%u %u %llu", &pin, &value, &timestamp);
+        sim_fill -= (eol - sim_buffer) + 1;
+        memmove(sim_buffer, eol+1, sim_fill);
+
+        if ( fields >= 2 && pin < SIM_PINS ) {
+            sim_level[pin] = value ? 1 : 0;
+            if ( sim_watched[pin] ) {
+                event->pin       = pin;
+                event->value     = sim_level[pin];
+                event->timestamp = (fields == 3) ? timestamp : gpio_timestamp();
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * next edge of a watched, scripted pin that has not been delivered yet. If there is none
+ * 'wakeup' is lowered to the time the next one is due.
+ */
+static int sim_script_event( gpio_event_t *event, uint64_t now, uint64_t *wakeup ) {
+    for ( int n=0; n<num_scripted; n++ ) {
+        int      index = (next_scripted + n) % num_scripted;
+        uint8_t  pin   = sim_scripted[index];
+        uint64_t changed, next;
+        uint8_t  level = sim_script_level(pin, now, &changed);
+
+        if ( level != sim_level[pin] ) {
+            next_scripted    = (index + 1) % num_scripted;
+            sim_level[pin]   = level;
+            event->pin       = pin;
+            event->value     = level;
+            event->timestamp = changed;
+            return 1;
+        }
+        next = changed ? changed + sim_period[pin] : sim_epoch + sim_phase[pin] + sim_period[pin];
+        if ( next < *wakeup ) {
+            *wakeup = next;
+        }
+    }
+    return 0;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Line events of the v1 interface are stamped with CLOCK_REALTIME by kernels before 5.7,
+ * with CLOCK_MONOTONIC by later ones (v2 events always are). A timestamp closer to the
+ * wall clock than to the monotonic one is moved over by their current difference, so it
+ * keeps the kernel's precision. An edge is never later than now.
+ * ---------------------------------------------------------------------------------------
+ */
+static uint64_t monotonic_edge( uint64_t timestamp ) {
+    struct timespec ts;
+    uint64_t        now = gpio_timestamp(), wall;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wall = (uint64_t)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+    if ( wall > now && timestamp > now + (wall - now) / 2 ) {
+        timestamp -= wall - now;
+    }
+    return timestamp < now ? timestamp : now;
+}
+
+static int read_event( int index, gpio_event_t *event ) {
+    if ( backend == GPIO_SIM ) {
+        ssize_t length = read(sim_fd, sim_buffer+sim_fill, sizeof(sim_buffer)-sim_fill-1);
+        if ( length > 0 ) {
+            sim_fill += length;
+        } else if ( sim_fill == sizeof(sim_buffer)-1 ) {
+            sim_fill = 0;                                   /* garbage, start over     */
+        }
+        return sim_next_event(event);
+    }
+#ifdef GPIO_V2_GET_LINE_IOCTL
+    if ( watch_v2[index] ) {
+        struct gpio_v2_line_event data;
+        if ( read(watch_fds[index].fd, &data, sizeof(data)) != sizeof(data) ) {
+            return 0;
+        }
+        event->pin       = watch_pins[index];
+        event->value     = (data.id == GPIO_V2_LINE_EVENT_RISING_EDGE) ? 1 : 0;
+        event->timestamp = data.timestamp_ns / 1000;
+        return 1;
+    }
+#endif
+    struct gpioevent_data data;
+    if ( read(watch_fds[index].fd, &data, sizeof(data)) != sizeof(data) ) {
+        return 0;
+    }
+    event->pin       = watch_pins[index];
+    event->value     = (data.id == GPIOEVENT_EVENT_RISING_EDGE) ? 1 : 0;
+    event->timestamp = monotonic_edge(data.timestamp / 1000);
+    return 1;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Wait up to timeout msecs, or until deadline (usec, CLOCK_MONOTONIC), for the next edge
+ * event on any watched pin.
+ * Returns 1 if an event was stored, 0 on timeout, signal or wake fd readable and -1 on
+ * error.
+ * ---------------------------------------------------------------------------------------
+ */
+int gpio_wait( int timeout, gpio_event_t *event ) {
+    return gpio_wait_until(gpio_timestamp() + (uint64_t)timeout*1000, event);
+}
+
+int gpio_wait_until( uint64_t deadline, gpio_event_t *event ) {
+    // nothing that could wake us early, sleep for the exact time
+    if ( num_watches == 0 && num_scripted == 0 ) {
+        struct timespec ts = { deadline / 1000000, deadline % 1000000 * 1000 };
+        int             err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        return (err && err != EINTR) ? -1 : 0;
+    }
+
+    for ( ;; ) {
+        uint64_t        now    = gpio_timestamp();
+        uint64_t        wakeup = deadline;
+        struct timespec ts;
+        int             ready;
+
+        if ( backend == GPIO_SIM &&
+             (sim_next_event(event) || sim_script_event(event, now, &wakeup)) ) {
+            return 1;
+        }
+
+        // poll at least once, so a zero timeout still picks up pending events
+        wakeup     = (wakeup > now) ? wakeup - now : 0;
+        ts.tv_sec  = wakeup / 1000000;
+        ts.tv_nsec = wakeup % 1000000 * 1000;
+        ready = ppoll(watch_fds, num_watches, &ts, NULL);
+        if ( ready == -1 ) {
+            return (errno == EINTR) ? 0 : -1;
+        }
+
+        // start scanning where we left off so a chatty line can't starve the others
+        for ( int n=0; n<num_watches && ready; n++ ) {
+            int index = (next_watch + n) % num_watches;
+            if ( watch_fds[index].revents & POLLIN ) {
+                next_watch = (index + 1) % num_watches;
+                if ( watch_wake[index] ) {
+                    return 0;
+                }
+                if ( read_event(index, event) ) {
+                    return 1;
+                }
+            }
+        }
+        if ( gpio_timestamp() >= deadline ) {
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef GPIO_h
+#define GPIO_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * GPIO backends
+ *   GPIO_WIRINGPI  real hardware, levels via wiringPi, edges via /dev/gpiochipN
+ *   GPIO_SIM       simulated lines, edges are injected through a pipe/FIFO with
+ *                  lines of the form "<pin> <value>\n" or scripted: toggling pins,
+ *                  noisy reads and DHT11 waveforms with injected failures
+ * ---------------------------------------------------------------------------------------
+ */
+typedef enum { GPIO_WIRINGPI, GPIO_SIM } gpio_backend_t;
+
+#define GPIO_BANK_MAX  64                       /* lines read by one gpio_read_bank()  */
+
+typedef struct {
+    uint8_t  pin;
+    uint8_t  value;
+    uint64_t timestamp;                        /* usec, CLOCK_MONOTONIC               */
+} gpio_event_t;
+
+bool     gpio_init( gpio_backend_t backend, const char *chip, const char *fifo );
+void     gpio_end( void );
+gpio_backend_t gpio_backend( void );
+void     gpio_input( uint8_t pin );
+int      gpio_read( uint8_t pin );
+bool     gpio_watch( uint8_t pin );
+void     gpio_debounce( uint8_t pin, uint32_t usecs );
+bool     gpio_debounced( uint8_t pin );
+bool     gpio_bank( const uint8_t *pins, int count );
+uint64_t gpio_read_bank( void );
+bool     gpio_wake_on( int fd );
+int      gpio_fds( int *fds, int max );
+uint64_t gpio_next_event( void );
+int      gpio_wait( int timeout, gpio_event_t *event );
+int      gpio_wait_until( uint64_t deadline, gpio_event_t *event );
+uint64_t gpio_timestamp( void );
+
+void     gpio_sim_set( uint8_t pin, uint8_t value );
+void     gpio_sim_epoch( uint64_t epoch );
+void     gpio_sim_toggle( uint8_t pin, uint64_t period, uint64_t phase, uint8_t noise );
+void     gpio_sim_dht( uint8_t pin, uint8_t humidity, uint8_t celcius, uint8_t fail, uint16_t jitter );
+int      gpio_sim_capture( uint8_t pin, uint32_t *edges, int max, uint8_t *level );
+
+#endif /* GPIO_h */
@@ -0,0 +1,570 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "Journal.h"
+
+#define JOURNAL_MAGIC    0x534a5352             /* "RSJS"                              */
+#define JOURNAL_VERSION  1
+#define JOURNAL_HEADER   32                     /* bytes of a block before its data    */
+#define JOURNAL_BITS     ((JOURNAL_BLOCK - JOURNAL_HEADER) * 8)
+#define NO_BLOCK         UINT32_MAX
+
+typedef struct {
+    uint32_t  magic;                            /* written last                        */
+    uint32_t  version;
+    uint32_t  sequence;
+    uint32_t  blocks;                           /* blocks the segment has room for     */
+    uint32_t  used;                             /* blocks handed out                   */
+    uint32_t  sensors;                          /* labels that follow                  */
+    uint32_t  data;                             /* offset of the first block           */
+    uint32_t  reserved;
+    uint64_t  created;                          /* msecs since the epoch               */
+    char      labels[];                         /* NUL terminated, by sensor index     */
+} journal_segment_t;
+
+typedef struct {
+    uint32_t  index;                            /* sensor index in the segment         */
+    uint16_t  count;                            /* readings, written last              */
+    uint16_t  bits;                             /* bits of data in use                 */
+    uint64_t  first;                            /* msecs since the epoch, first reading */
+    uint64_t  last;                             /* ... and last one                    */
+    uint16_t  value;                            /* first value                         */
+    uint16_t  reserved[3];
+    uint8_t   data[JOURNAL_BLOCK - JOURNAL_HEADER];
+} journal_block_t;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Prefix codes: code k is k one bits and a zero (the last code has no zero), followed by
+ * the zigzag encoded number in 'width' bits
+ * ---------------------------------------------------------------------------------------
+ */
+static const uint8_t time_widths[]  = { 0, 7, 12, 20, 64 };
+static const uint8_t value_widths[] = { 0, 2, 6, 17 };
+
+#define TIME_CODES   (sizeof(time_widths))
+#define VALUE_CODES  (sizeof(value_widths))
+
+typedef struct {
+    uint32_t  block;                            /* block of the sensor, or NO_BLOCK    */
+    uint64_t  time;                             /* of the last reading                 */
+    int64_t   delta;                            /* time between the last two readings  */
+    uint16_t  value;
+} journal_stream_t;
+
+static char              *journal_dir  = NULL;
+static uint32_t          segment_size  = 0;
+static uint64_t          max_size      = 0;
+static journal_segment_t *segment      = NULL;
+static uint32_t          sequence      = 0;     /* of the current segment              */
+static uint32_t          first_sequence = 1;    /* oldest segment on disk              */
+static char              *labels       = NULL;
+static size_t            labels_length = 0;
+static journal_stream_t  *streams      = NULL;
+static uint32_t          num_streams   = 0;
+static journal_stats_t   stats;
+
+static uint64_t zigzag( int64_t value ) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag( uint64_t value ) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int code_of( uint64_t value, const uint8_t *widths, int codes ) {
+    int code = 0;
+
+    while ( code < codes-1 && widths[code] < 64 && value >> widths[code] ) {
+        code++;
+    }
+    return code;
+}
+
+static int code_bits( int code, const uint8_t *widths, int codes ) {
+    return (code < codes-1 ? code+1 : code) + widths[code];
+}
+
+static void put_bits( uint8_t *data, uint32_t *pos, uint64_t value, int count ) {
+    for ( int bit=count-1; bit>=0; bit--, (*pos)++ ) {
+        if ( (value >> bit) & 1 ) {
+            data[*pos >> 3] |= 0x80 >> (*pos & 7);
+        }
+    }
+}
+
+static uint64_t get_bits( const uint8_t *data, uint32_t *pos, int count ) {
+    uint64_t value = 0;
+
+    for ( int bit=0; bit<count; bit++, (*pos)++ ) {
+        value = (value << 1) | ((data[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+    }
+    return value;
+}
+
+static void put_code( uint8_t *data, uint32_t *pos, uint64_t value, const uint8_t *widths, int codes ) {
+    int code = code_of(value, widths, codes);
+
+    put_bits(data, pos, (1u << code) - 1, code);
+    if ( code < codes-1 ) {
+        (*pos)++;                                   /* the zero, data starts zeroed    */
+    }
+    put_bits(data, pos, value, widths[code]);
+}
+
+/* false if the code runs past 'limit' bits, the block is corrupt                        */
+static bool get_code( const uint8_t *data, uint32_t *pos, uint32_t limit, const uint8_t *widths,
+                      int codes, uint64_t *value ) {
+    int code = 0;
+
+    while ( code < codes-1 ) {
+        if ( *pos >= limit ) {
+            return false;
+        }
+        if ( !get_bits(data, pos, 1) ) {
+            break;
+        }
+        code++;
+    }
+    if ( *pos + widths[code] > limit ) {
+        return false;
+    }
+    *value = get_bits(data, pos, widths[code]);
+    return true;
+}
+
+static void segment_path( char *path, size_t size, const char *dir, uint32_t number ) {
+    snprintf(path, size, "%s/journal.%08u", dir, number);
+}
+
+static int is_segment( const struct dirent *entry ) {
+    return !strncmp(entry->d_name, "journal.", 8);
+}
+
+static uint64_t epoch_msecs( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Open the next segment and drop the oldest ones beyond the size cap. Every sensor
+ * starts a new block with its next reading.
+ * ---------------------------------------------------------------------------------------
+ */
+static bool start_segment( void ) {
+    char   path[4096];
+    size_t data = (sizeof(journal_segment_t) + labels_length + JOURNAL_BLOCK - 1) / JOURNAL_BLOCK * JOURNAL_BLOCK;
+    int    fd;
+
+    if ( segment ) {
+        msync(segment, segment_size, MS_ASYNC);
+        munmap(segment, segment_size);
+        segment = NULL;
+    }
+    for ( uint32_t index=0; index<num_streams; index++ ) {
+        streams[index].block = NO_BLOCK;
+    }
+    if ( data + JOURNAL_BLOCK > segment_size ) {
+        fprintf(stderr, "Error: journal segments of %u bytes can't hold %u sensors\n",
+                segment_size, num_streams);
+        return false;
+    }
+
+    segment_path(path, sizeof(path), journal_dir, ++sequence);
+    fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if ( fd == -1 || ftruncate(fd, segment_size) == -1 ) {
+        fprintf(stderr, "Error: create %s [%s]\n", path, strerror(errno));
+        if ( fd != -1 ) {
+            close(fd);
+        }
+        return false;
+    }
+    segment = mmap(NULL, segment_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( segment == MAP_FAILED ) {
+        fprintf(stderr, "Error: mmap %s [%s]\n", path, strerror(errno));
+        segment = NULL;
+        return false;
+    }
+
+    segment->version  = JOURNAL_VERSION;
+    segment->sequence = sequence;
+    segment->blocks   = (segment_size - data) / JOURNAL_BLOCK;
+    segment->sensors  = num_streams;
+    segment->data     = data;
+    segment->created  = epoch_msecs();
+    memcpy(segment->labels, labels, labels_length);
+    __atomic_store_n(&segment->magic, JOURNAL_MAGIC, __ATOMIC_RELEASE);
+
+    while ( first_sequence < sequence && (uint64_t)(sequence - first_sequence + 1) * segment_size > max_size ) {
+        segment_path(path, sizeof(path), journal_dir, first_sequence++);
+        if ( unlink(path) == -1 && errno != ENOENT ) {
+            fprintf(stderr, "Error: unlink %s [%s]\n", path, strerror(errno));
+        }
+    }
+    stats.segments = sequence - first_sequence + 1;
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Journal into 'dir', segments of 'segment_size' bytes, 'max_size' bytes for all of them.
+ * Writing starts with journal_sensors(), always in a new segment.
+ * ---------------------------------------------------------------------------------------
+ */
+bool journal_open( const char *dir, uint32_t size, uint64_t cap ) {
+    struct dirent **entries;
+    int           count;
+
+    if ( mkdir(dir, 0755) == -1 && errno != EEXIST ) {
+        fprintf(stderr, "Error: mkdir %s [%s]\n", dir, strerror(errno));
+        return false;
+    }
+    count = scandir(dir, &entries, is_segment, alphasort);
+    if ( count == -1 ) {
+        fprintf(stderr, "Error: scandir %s [%s]\n", dir, strerror(errno));
+        return false;
+    }
+    sequence = 0;
+    first_sequence = 0;
+    for ( int i=0; i<count; i++ ) {
+        uint32_t number = strtoul(entries[i]->d_name + 8, NULL, 10);
+
+        if ( number > sequence ) {
+            sequence = number;
+        }
+        if ( number && (first_sequence == 0 || number < first_sequence) ) {
+            first_sequence = number;
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    if ( first_sequence == 0 ) {
+        first_sequence = sequence + 1;
+    }
+
+    journal_dir  = strdup(dir);
+    segment_size = size / JOURNAL_BLOCK * JOURNAL_BLOCK;
+    max_size     = cap;
+    memset(&stats, 0, sizeof(stats));
+    return journal_dir != NULL;
+}
+
+void journal_close( void ) {
+    if ( segment ) {
+        msync(segment, segment_size, MS_SYNC);
+        munmap(segment, segment_size);
+        segment = NULL;
+    }
+    free(streams);
+    free(labels);
+    free(journal_dir);
+    streams     = NULL;
+    labels      = NULL;
+    journal_dir = NULL;
+    num_streams = 0;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * The sensor table (label of each index) readings are journaled for. Starts a new
+ * segment, so every segment knows which sensors its indices stand for.
+ * ---------------------------------------------------------------------------------------
+ */
+bool journal_sensors( const char * const *names, uint32_t count ) {
+    journal_stream_t *new_streams;
+    size_t           length = 0;
+    char             *new_labels;
+
+    if ( !journal_dir ) {
+        return false;
+    }
+    for ( uint32_t index=0; index<count; index++ ) {
+        length += strlen(names[index]) + 1;
+    }
+    new_labels  = malloc(length ? length : 1);
+    new_streams = malloc((count ? count : 1) * sizeof(journal_stream_t));
+    if ( !new_labels || !new_streams ) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(new_labels);
+        free(new_streams);
+        return false;
+    }
+    length = 0;
+    for ( uint32_t index=0; index<count; index++ ) {
+        size_t size = strlen(names[index]) + 1;
+
+        memcpy(new_labels+length, names[index], size);
+        length += size;
+    }
+    free(labels);
+    free(streams);
+    labels        = new_labels;
+    labels_length = length;
+    streams       = new_streams;
+    num_streams   = count;
+    return start_segment();
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Add a reading (time in msecs since the epoch). Data bits go in before the count that
+ * makes them visible, a reader never sees a half written reading.
+ * ---------------------------------------------------------------------------------------
+ */
+void journal_append( uint32_t index, uint64_t time, uint16_t value ) {
+    journal_stream_t *stream;
+    journal_block_t  *block;
+
+    if ( !segment || index >= num_streams ) {
+        return;
+    }
+    stream = &streams[index];
+
+    if ( stream->block != NO_BLOCK ) {
+        int64_t  delta = time - stream->time;
+        uint64_t dod   = zigzag(delta - stream->delta);
+        uint64_t step  = zigzag((int64_t)value - stream->value);
+        uint32_t need  = code_bits(code_of(dod, time_widths, TIME_CODES), time_widths, TIME_CODES) +
+                         code_bits(code_of(step, value_widths, VALUE_CODES), value_widths, VALUE_CODES);
+
+        block = (journal_block_t*)((uint8_t*)segment + segment->data) + stream->block;
+        if ( block->bits + need <= JOURNAL_BITS && block->count < UINT16_MAX ) {
+            uint32_t pos = block->bits;
+
+            put_code(block->data, &pos, dod, time_widths, TIME_CODES);
+            put_code(block->data, &pos, step, value_widths, VALUE_CODES);
+            block->bits = pos;
+            block->last = time;
+            __atomic_store_n(&block->count, block->count + 1, __ATOMIC_RELEASE);
+
+            stream->delta = delta;
+            stream->time  = time;
+            stream->value = value;
+            stats.readings++;
+            return;
+        }
+    }
+
+    // first reading of the sensor in this segment, or its block is full
+    if ( segment->used == segment->blocks && !start_segment() ) {
+        return;
+    }
+    block = (journal_block_t*)((uint8_t*)segment + segment->data) + segment->used;
+    block->index = index;
+    block->first = time;
+    block->last  = time;
+    block->value = value;
+    block->count = 1;
+    __atomic_store_n(&segment->used, segment->used + 1, __ATOMIC_RELEASE);
+
+    stream->block = segment->used - 1;
+    stream->delta = 0;
+    stream->time  = time;
+    stream->value = value;
+    stats.readings++;
+    stats.blocks++;
+    stats.bytes += JOURNAL_BLOCK;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Have what was written so far on disk, the only fsync the journal does on its own is
+ * when it closes
+ * ---------------------------------------------------------------------------------------
+ */
+void journal_sync( void ) {
+    if ( segment ) {
+        msync(segment, segment_size, MS_SYNC);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Counted since journal_open(), segments is how many there are on disk
+ * ---------------------------------------------------------------------------------------
+ */
+void journal_stats( journal_stats_t *result ) {
+    *result = stats;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Call visit() for every reading in 'dir' between 'from' and 'to' (msecs since the epoch,
+ * inclusive). Readings come sensor by sensor in blocks, segments oldest first. Blocks
+ * entirely outside the range are not decoded. Returns the number of segments read, or
+ * -1 if the directory can't be read. stats (if not NULL) covers the whole journal.
+ * ---------------------------------------------------------------------------------------
+ */
+/* false if the readings run past the bits in use, the ones before are still visited    */
+static bool scan_block( const journal_block_t *block, const char *label, uint64_t from, uint64_t to,
+                        journal_visit_t visit, void *arg ) {
+    uint16_t count = __atomic_load_n(&block->count, __ATOMIC_ACQUIRE);
+    uint32_t bits  = block->bits;
+    uint64_t time  = block->first;
+    uint16_t value = block->value;
+    int64_t  delta = 0;
+    uint32_t pos   = 0;
+
+    if ( bits > JOURNAL_BITS ) {
+        return false;
+    }
+    for ( uint16_t n=0; n<count; n++ ) {
+        if ( n ) {
+            uint64_t dod, step;
+
+            if ( !get_code(block->data, &pos, bits, time_widths, TIME_CODES, &dod) ||
+                 !get_code(block->data, &pos, bits, value_widths, VALUE_CODES, &step) ) {
+                return false;
+            }
+            delta += unzigzag(dod);
+            time  += delta;
+            value += unzigzag(step);
+        }
+        if ( time >= from && time <= to ) {
+            visit(label, time, value, arg);
+        }
+    }
+    return true;
+}
+
+/* false if the labels of all sensors do not fit in front of the first block            */
+static bool scan_labels( const journal_segment_t *seg, const char **names ) {
+    const char *label = seg->labels;
+    const char *end   = (const char*)seg + seg->data;
+
+    for ( uint32_t index=0; index<seg->sensors; index++ ) {
+        size_t length = strnlen(label, end - label);
+
+        if ( length == (size_t)(end - label) ) {
+            return false;                           /* no room for its NUL             */
+        }
+        names[index] = label;
+        label += length + 1;
+    }
+    return true;
+}
+
+int journal_scan( const char *dir, uint64_t from, uint64_t to, journal_visit_t visit,
+                  void *arg, journal_stats_t *result ) {
+    struct dirent **entries;
+    int           count, scanned = 0;
+
+    if ( result ) {
+        memset(result, 0, sizeof(journal_stats_t));
+    }
+    count = scandir(dir, &entries, is_segment, alphasort);
+    if ( count == -1 ) {
+        fprintf(stderr, "Error: scandir %s [%s]\n", dir, strerror(errno));
+        return -1;
+    }
+
+    for ( int i=0; i<count; i++ ) {
+        char              path[4096];
+        struct stat       st;
+        journal_segment_t *seg;
+        const char        **names = NULL;
+        bool              valid;
+        int               fd;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+        free(entries[i]);
+        fd = open(path, O_RDONLY);
+        if ( fd == -1 || fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(journal_segment_t) ) {
+            if ( fd != -1 ) {
+                close(fd);
+            }
+            continue;
+        }
+        seg = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if ( seg == MAP_FAILED ) {
+            continue;
+        }
+
+        if ( seg->magic != JOURNAL_MAGIC || seg->version != JOURNAL_VERSION ) {
+            munmap(seg, st.st_size);
+            continue;
+        }
+        // every label takes at least its NUL between the header and the first block
+        valid = seg->data >= sizeof(journal_segment_t) && seg->data <= st.st_size &&
+                seg->sensors <= seg->data - sizeof(journal_segment_t);
+        if ( valid && !(names = malloc((seg->sensors ? seg->sensors : 1) * sizeof(char*))) ) {
+            fprintf(stderr, "Error: Out of memory scanning %s\n", path);
+            munmap(seg, st.st_size);
+            continue;
+        }
+        if ( !valid || !scan_labels(seg, names) ) {
+            fprintf(stderr, "Warning: corrupt segment %s\n", path);
+            if ( result ) {
+                result->corrupt++;
+            }
+        } else {
+            const journal_block_t *blocks = (const journal_block_t*)((const uint8_t*)seg + seg->data);
+            uint32_t              room    = (st.st_size - seg->data) / JOURNAL_BLOCK;
+            uint32_t              used    = __atomic_load_n(&seg->used, __ATOMIC_ACQUIRE);
+
+            if ( used > room ) {
+                used = room;
+            }
+            for ( uint32_t n=0; n<used; n++ ) {
+                const journal_block_t *block = &blocks[n];
+
+                if ( block->index >= seg->sensors ) {
+                    continue;
+                }
+                if ( result ) {
+                    result->blocks++;
+                    result->readings += block->count;
+                    result->bytes    += JOURNAL_BLOCK;
+                }
+                if ( block->last >= from && block->first <= to &&
+                     !scan_block(block, names[block->index], from, to, visit, arg) ) {
+                    fprintf(stderr, "Warning: corrupt block %u in %s\n", n, path);
+                    if ( result ) {
+                        result->corrupt++;
+                    }
+                }
+            }
+            if ( result ) {
+                result->segments++;
+            }
+            scanned++;
+        }
+        free(names);
+        munmap(seg, st.st_size);
+    }
+    free(entries);
+    return scanned;
+}
@@ -0,0 +1,65 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Journal_h
+#define Journal_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Journal of all published readings, kept on the device in memory mapped segment files
+ * <dir>/journal.<sequence>. A segment starts with the labels of the sensors it covers
+ * and is then handed out in blocks, each holding readings of one sensor: the first one
+ * as is, the rest bit packed as delta-of-delta of the time and delta of the value. A
+ * steadily toggling input takes a few bits per reading.
+ * Writes go to the mapped pages only, the kernel writes them back in the background and
+ * journal_sync() forces it. When a segment is full the next one is started and the
+ * oldest ones are deleted to keep all of them within the size cap.
+ * ---------------------------------------------------------------------------------------
+ */
+#define JOURNAL_BLOCK    256                    /* bytes per block                     */
+
+typedef struct {
+    uint32_t  segments;                         /* segment files                       */
+    uint32_t  blocks;                           /* blocks in use                       */
+    uint64_t  readings;
+    uint64_t  bytes;                            /* size of the blocks in use           */
+    uint32_t  corrupt;                          /* blocks and segments found corrupt   */
+} journal_stats_t;
+
+typedef void (*journal_visit_t)( const char *label, uint64_t time, uint16_t value, void *arg );
+
+bool     journal_open( const char *dir, uint32_t segment_size, uint64_t max_size );
+void     journal_close( void );
+bool     journal_sensors( const char * const *labels, uint32_t count );
+void     journal_append( uint32_t index, uint64_t time, uint16_t value );
+void     journal_sync( void );
+void     journal_stats( journal_stats_t *stats );
+
+int      journal_scan( const char *dir, uint64_t from, uint64_t to, journal_visit_t visit,
+                       void *arg, journal_stats_t *stats );
+
+#endif /* Journal_h */
@@ -0,0 +1,319 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "Log.h"
+
+#define LOG_NICE     19                         /* drain thread, lowest CFS weight     */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Multiple producer / single consumer ring. A producer claims a slot by moving ring_head
+ * while the slot's sequence says it is free (seq == position), fills it and marks it
+ * ready (seq == position+1). The drain thread frees it again (seq == position+LOG_RING).
+ * A producer interrupted after claiming its slot (e.g. by a signal handler logging
+ * itself) only holds back the lines behind it, nobody waits for a lock.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    atomic_size_t  seq;
+    int            priority;
+    char           text[LOG_LINE];
+} log_slot_t;
+
+static log_slot_t       ring[LOG_RING];
+static atomic_size_t    ring_head;              /* next slot to claim (producers)      */
+static atomic_size_t    ring_tail;              /* next slot to write (drain thread)   */
+static sem_t            ring_sem;
+static pthread_t        drain;
+static atomic_bool      ring_open;              /* log_msg() goes through the ring     */
+static atomic_bool      drain_running;
+static uint32_t         drain_rate    = 0;      /* lines per second, 0: no limit       */
+
+static atomic_uint      queued;
+static atomic_uint      dropped;
+static atomic_uint      depth_max;
+static log_stats_t      stats;                  /* the drain thread's counters         */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Drain thread state: token bucket for the rate limit and the last line written
+ * ---------------------------------------------------------------------------------------
+ */
+static uint64_t         budget        = 0;      /* lines * 1000000                     */
+static uint64_t         budget_time   = 0;      /* usec, CLOCK_MONOTONIC               */
+static uint32_t         suppressed    = 0;      /* lines dropped since the last notice */
+static int              last_priority = -1;
+static char             last_text[LOG_LINE];
+static uint32_t         repeats       = 0;      /* of last_text, not written yet       */
+static uint64_t         repeat_start  = 0;      /* usec, first of them                 */
+
+static uint64_t log_timestamp( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+static bool log_token( uint64_t now ) {
+    if ( drain_rate == 0 ) {
+        return true;
+    }
+    budget += (now - budget_time) * drain_rate;
+    budget_time = now;
+    if ( budget > (uint64_t)drain_rate * 1000000 ) {
+        budget = (uint64_t)drain_rate * 1000000;
+    }
+    if ( budget < 1000000 ) {
+        return false;
+    }
+    budget -= 1000000;
+    return true;
+}
+
+static void log_flush_repeats( void ) {
+    if ( repeats ) {
+        syslog(last_priority, "last message repeated %u times", repeats);
+        stats.written++;
+        repeats = 0;
+    }
+}
+
+static void log_flush_suppressed( void ) {
+    if ( suppressed ) {
+        syslog(LOG_WARNING, "%u log messages suppressed, more than %u per second",
+               suppressed, drain_rate);
+        stats.written++;
+        suppressed = 0;
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * One line from the ring: fold it into the repeats of the last one, drop it over the
+ * rate limit or write it
+ * ---------------------------------------------------------------------------------------
+ */
+static void log_write( int priority, const char *text, uint64_t now ) {
+    if ( priority == last_priority && !strcmp(text, last_text) ) {
+        if ( repeats++ == 0 ) {
+            repeat_start = now;
+        }
+        stats.repeated++;
+        return;
+    }
+    log_flush_repeats();
+
+    if ( !log_token(now) ) {
+        suppressed++;
+        stats.suppressed++;
+        return;
+    }
+    log_flush_suppressed();
+    syslog(priority, "%s", text);
+    stats.written++;
+    last_priority = priority;
+    strcpy(last_text, text);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Pending notices: repeats held back long enough, suppressed lines once the rate allows
+ * ---------------------------------------------------------------------------------------
+ */
+static void log_notices( uint64_t now ) {
+    if ( repeats && now - repeat_start >= (uint64_t)LOG_REPEAT * 1000000 ) {
+        log_flush_repeats();
+    }
+    if ( suppressed && log_token(now) ) {
+        log_flush_suppressed();
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Drain thread, the only consumer of the ring. Signals are left to the other threads,
+ * the semaphore only wakes it up, every pass takes whatever is ready.
+ * ---------------------------------------------------------------------------------------
+ */
+static void *log_drain( void *arg ) {
+    sigset_t signals;
+
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), LOG_NICE);
+
+    for ( ;; ) {
+        bool     stopping = !drain_running;
+        size_t   tail     = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+        uint64_t now      = log_timestamp();
+
+        for ( ;; ) {
+            log_slot_t *slot = &ring[tail & (LOG_RING-1)];
+
+            if ( atomic_load_explicit(&slot->seq, memory_order_acquire) != tail + 1 ) {
+                break;
+            }
+            log_write(slot->priority, slot->text, now);
+            atomic_store_explicit(&slot->seq, tail + LOG_RING, memory_order_release);
+            atomic_store_explicit(&ring_tail, ++tail, memory_order_release);
+        }
+        log_notices(now);
+        if ( stopping ) {
+            break;
+        }
+
+        // pending notices need a look now and then, even without new lines
+        if ( repeats || suppressed ) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec++;
+            sem_timedwait(&ring_sem, &ts);
+        } else {
+            sem_wait(&ring_sem);
+        }
+    }
+    log_flush_repeats();
+    log_flush_suppressed();
+    return NULL;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Start the drain thread, at most 'rate' lines per second (0: no limit) go to syslog.
+ * Threads do not survive fork(), call it once the process is daemonized.
+ * ---------------------------------------------------------------------------------------
+ */
+bool log_start( uint32_t rate ) {
+    int err;
+
+    if ( drain_running ) {
+        return true;
+    }
+    for ( size_t i=0; i<LOG_RING; i++ ) {
+        atomic_init(&ring[i].seq, i);
+    }
+    atomic_init(&ring_head, 0);
+    atomic_init(&ring_tail, 0);
+    atomic_init(&queued,    0);
+    atomic_init(&dropped,   0);
+    atomic_init(&depth_max, 0);
+    memset(&stats, 0, sizeof(stats));
+    drain_rate    = rate;
+    budget        = (uint64_t)rate * 1000000;
+    budget_time   = log_timestamp();
+    suppressed    = 0;
+    repeats       = 0;
+    last_priority = -1;
+    sem_init(&ring_sem, 0, 0);
+
+    drain_running = true;
+    err = pthread_create(&drain, NULL, log_drain, NULL);
+    if ( err ) {
+        fprintf(stderr, "Error: log drain thread [%s]\n", strerror(err));
+        drain_running = false;
+        sem_destroy(&ring_sem);
+        return false;
+    }
+    ring_open = true;
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Write what is in the ring and stop the drain thread. A line whose producer was
+ * interrupted while filling it (log_stop() from a signal handler) is lost.
+ * ---------------------------------------------------------------------------------------
+ */
+void log_stop( void ) {
+    if ( !drain_running ) {
+        return;
+    }
+    ring_open     = false;
+    drain_running = false;
+    sem_post(&ring_sem);
+    pthread_join(drain, NULL);
+    sem_destroy(&ring_sem);
+}
+
+void log_msg( int priority, const char *format, ... ) {
+    va_list    args;
+    log_slot_t *slot;
+    size_t     pos, depth;
+    unsigned   max;
+
+    va_start(args, format);
+    if ( !ring_open ) {
+        vsyslog(priority, format, args);
+        va_end(args);
+        return;
+    }
+
+    // claim a slot, keep the last quarter of the ring for warnings and errors
+    pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    for ( ;; ) {
+        depth = pos - atomic_load_explicit(&ring_tail, memory_order_acquire);
+        if ( depth >= LOG_RING || (depth >= LOG_RING/4*3 && LOG_PRI(priority) > LOG_WARNING) ) {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            va_end(args);
+            return;
+        }
+        slot = &ring[pos & (LOG_RING-1)];
+        if ( atomic_load_explicit(&slot->seq, memory_order_acquire) == pos ) {
+            if ( atomic_compare_exchange_weak_explicit(&ring_head, &pos, pos + 1,
+                                                       memory_order_relaxed, memory_order_relaxed) ) {
+                break;
+            }
+        } else {
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        }
+    }
+
+    slot->priority = priority;
+    vsnprintf(slot->text, LOG_LINE, format, args);
+    va_end(args);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    sem_post(&ring_sem);
+
+    atomic_fetch_add_explicit(&queued, 1, memory_order_relaxed);
+    max = atomic_load_explicit(&depth_max, memory_order_relaxed);
+    while ( depth + 1 > max &&
+            !atomic_compare_exchange_weak_explicit(&depth_max, &max, depth + 1,
+                                                   memory_order_relaxed, memory_order_relaxed) );
+}
+
+void log_stats( log_stats_t *out ) {
+    *out           = stats;
+    out->queued    = atomic_load_explicit(&queued,    memory_order_relaxed);
+    out->dropped   = atomic_load_explicit(&dropped,   memory_order_relaxed);
+    out->depth_max = atomic_load_explicit(&depth_max, memory_order_relaxed);
+}
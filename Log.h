@@ -0,0 +1,60 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Log_h
+#define Log_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <syslog.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Asynchronous syslog: log_msg() formats into a preallocated lock-free ring and returns,
+ * a low priority thread hands the lines to syslog(). It may be called from any thread
+ * and from signal handlers. The drain thread writes no more than 'rate' lines per second
+ * and folds repeats of the last line into one "repeated" line. With the ring full, the
+ * line is dropped; once it is three quarters full only warnings and errors get in.
+ * Before log_start() and after log_stop() log_msg() calls syslog() directly.
+ * ---------------------------------------------------------------------------------------
+ */
+#define LOG_RING     256                        /* lines, must be a power of two       */
+#define LOG_LINE     200                        /* bytes per line, longer are cut      */
+#define LOG_REPEAT   30                         /* secs a repeated line is held back   */
+
+typedef struct {
+    uint32_t  queued;                           /* lines accepted by the ring          */
+    uint32_t  dropped;                          /* lines rejected, ring full           */
+    uint32_t  written;                          /* lines passed to syslog()            */
+    uint32_t  suppressed;                       /* lines over the rate limit           */
+    uint32_t  repeated;                         /* repeats of the last line folded     */
+    uint32_t  depth_max;                        /* most lines waiting at once          */
+} log_stats_t;
+
+bool log_start( uint32_t rate );
+void log_stop( void );
+void log_msg( int priority, const char *format, ... ) __attribute__((format(printf, 2, 3)));
+void log_stats( log_stats_t *stats );
+
+#endif /* Log_h */
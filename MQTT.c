@@ -20,9 +20,244 @@
  * ---------------------------------------------------------------------------------------
  */
 
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <time.h>
+
 #include "MQTT.h"
+#include "Stats.h"
 
 static struct mosquitto *mosq = NULL;
+static volatile bool    connected = false;
+static volatile bool    lost      = false;      /* disconnected after being connected  */
+static int              qos       = 0;
+static unsigned int     window    = 20;
+static bool             async     = false;
+static bool             external  = false;      /* caller drives the network loop      */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Asynchronous mode: mqtt_publish() only copies the message into a lock-free single
+ * producer / single consumer ring, the publisher thread hands it to mosquitto. With
+ * QoS > 0 at most 'window' messages are in flight, the publisher waits for PUBACKs
+ * beyond that.
+ * ---------------------------------------------------------------------------------------
+ */
+#define MQTT_QUEUE  1024                        /* slots, must be a power of two       */
+#define MQTT_SLOT   240                         /* topic+payload bytes kept inline     */
+
+typedef struct {
+    uint16_t  topic_length;
+    uint16_t  payload_length;
+    bool      retain;
+    uint64_t  queued;                           /* usec, CLOCK_MONOTONIC               */
+    uint32_t  ticket;                           /* mqtt_publish_tracked(), or 0        */
+    char      *heap;                            /* topic\0payload if too long inline   */
+    char      data[MQTT_SLOT];                  /* topic\0payload                      */
+} mqtt_slot_t;
+
+static mqtt_slot_t      *queue = NULL;
+static atomic_size_t    queue_head;             /* next slot to publish (consumer)     */
+static atomic_size_t    queue_tail;             /* next free slot (producer)           */
+static sem_t            queue_sem;
+static pthread_t        publisher;
+static volatile bool    publisher_running = false;
+static pthread_mutex_t  inflight_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   inflight_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int     inflight = 0;
+static mqtt_stats_t     stats;
+static atomic_uint      connects;               /* connections the broker accepted     */
+static atomic_uint      generation;             /* sockets mqtt_service() opened       */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Tracked messages by ticket, and the packet ids acknowledged last: the PUBACK may come
+ * in before the publishing thread got to note the packet id of its message. Both under
+ * inflight_lock.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef enum { TRACK_QUEUED, TRACK_SENT, TRACK_DELIVERED, TRACK_FAILED } mqtt_track_state_t;
+
+typedef struct {
+    uint32_t           ticket;
+    int                mid;
+    mqtt_track_state_t state;
+} mqtt_track_t;
+
+static mqtt_track_t     tracked[MQTT_TRACKED];
+static uint32_t         next_ticket = 1;
+static int              acked[MQTT_TRACKED];
+static size_t           acked_next  = 0;
+
+static void track_ack( int mid ) {
+    for ( size_t i=0; i<MQTT_TRACKED; i++ ) {
+        if ( tracked[i].state == TRACK_SENT && tracked[i].mid == mid ) {
+            tracked[i].state = TRACK_DELIVERED;
+            return;
+        }
+    }
+    acked[acked_next++ & (MQTT_TRACKED-1)] = mid;
+}
+
+static void track_sent( uint32_t ticket, int mid, bool success ) {
+    mqtt_track_t *entry = &tracked[ticket & (MQTT_TRACKED-1)];
+
+    pthread_mutex_lock(&inflight_lock);
+    if ( entry->ticket == ticket ) {
+        entry->mid   = mid;
+        entry->state = !success ? TRACK_FAILED : qos ? TRACK_SENT : TRACK_DELIVERED;
+        for ( size_t i=0; i<MQTT_TRACKED && entry->state == TRACK_SENT; i++ ) {
+            if ( acked[i] == mid ) {
+                entry->state = TRACK_DELIVERED;
+                acked[i]     = 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&inflight_lock);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Track the broker connection, called from the mosquitto network thread
+ * ---------------------------------------------------------------------------------------
+ */
+static void on_connect( struct mosquitto *m, void *obj, int rc ) {
+    connected = (rc == 0);
+    lost      = !connected;
+    if ( connected ) {
+        atomic_fetch_add_explicit(&connects, 1, memory_order_release);
+    }
+
+    // the publisher may be waiting to retry a message
+    pthread_mutex_lock(&inflight_lock);
+    pthread_cond_signal(&inflight_cond);
+    pthread_mutex_unlock(&inflight_lock);
+}
+
+static void on_disconnect( struct mosquitto *m, void *obj, int rc ) {
+    connected = false;
+    lost      = true;
+
+    // unacknowledged messages stay in flight, libmosquitto sends them again after the
+    // reconnect and their PUBACKs still come in
+    pthread_mutex_lock(&inflight_lock);
+    pthread_cond_signal(&inflight_cond);
+    pthread_mutex_unlock(&inflight_lock);
+}
+
+static void on_publish( struct mosquitto *m, void *obj, int mid ) {
+    pthread_mutex_lock(&inflight_lock);
+    if ( qos && inflight ) {
+        inflight--;
+        pthread_cond_signal(&inflight_cond);
+    }
+    if ( qos && mid ) {
+        track_ack(mid);
+    }
+    pthread_mutex_unlock(&inflight_lock);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Publisher thread, the only consumer of the queue. A message mosquitto could not take
+ * for lack of a connection stays at the head of the queue until the broker is back,
+ * new readings meanwhile are refused by mqtt_enqueue() and go to the spool.
+ * ---------------------------------------------------------------------------------------
+ */
+static void *mqtt_publisher( void *arg ) {
+    for ( ;; ) {
+        size_t      head, depth;
+        mqtt_slot_t *slot;
+        char        *data;
+        int         err, mid = 0;
+        uint32_t    attempt;
+
+        sem_wait(&queue_sem);
+        head  = atomic_load_explicit(&queue_head, memory_order_relaxed);
+        depth = atomic_load_explicit(&queue_tail, memory_order_acquire) - head;
+        if ( depth == 0 ) {
+            if ( !publisher_running ) {
+                break;
+            }
+            continue;
+        }
+        slot = &queue[head & (MQTT_QUEUE-1)];
+        data = slot->heap ? slot->heap : slot->data;
+
+        // respect the in-flight window
+        if ( qos ) {
+            pthread_mutex_lock(&inflight_lock);
+            if ( inflight >= window ) {
+                stats.window_full++;
+            }
+            while ( inflight >= window && publisher_running ) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec++;
+                pthread_cond_timedwait(&inflight_cond, &inflight_lock, &ts);
+            }
+            inflight++;
+            if ( inflight > stats.inflight_max ) {
+                stats.inflight_max = inflight;
+            }
+            pthread_mutex_unlock(&inflight_lock);
+        }
+
+        attempt = atomic_load_explicit(&connects, memory_order_acquire);
+        err = mosquitto_publish( mosq, &mid, data, slot->payload_length,
+                                 data + slot->topic_length + 1, qos, slot->retain);
+        if ( (err == MOSQ_ERR_NO_CONN || err == MOSQ_ERR_CONN_LOST) && publisher_running ) {
+            stats.retried++;
+            pthread_mutex_lock(&inflight_lock);
+            if ( qos && inflight ) {
+                inflight--;
+            }
+            while ( atomic_load_explicit(&connects, memory_order_acquire) == attempt && publisher_running ) {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec++;
+                pthread_cond_timedwait(&inflight_cond, &inflight_lock, &ts);
+            }
+            pthread_mutex_unlock(&inflight_lock);
+            sem_post(&queue_sem);                   /* same slot again                 */
+            continue;
+        }
+        if ( err != MOSQ_ERR_SUCCESS ) {
+            fprintf(stderr, "Error: mosquitto_publish failed [%s]\n", mosquitto_strerror(err));
+            stats.failed++;
+            if ( qos ) {
+                on_publish(mosq, NULL, 0);
+            }
+        } else {
+            stats.published++;
+            stats_record(STATS_PUBLISH, stats_timestamp() - slot->queued);
+        }
+        if ( slot->ticket ) {
+            track_sent(slot->ticket, mid, err == MOSQ_ERR_SUCCESS);
+        }
+
+        free(slot->heap);
+        slot->heap = NULL;
+        atomic_store_explicit(&queue_head, head + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * QoS level, in-flight window, publishing mode and who runs the network loop, call
+ * before mqtt_init()
+ * ---------------------------------------------------------------------------------------
+ */
+void mqtt_setup( int level, unsigned int inflight_window, bool asynchronous, bool external_loop ) {
+    qos      = (level < 0 || level > 2) ? 0 : level;
+    window   = inflight_window ? inflight_window : 1;
+    async    = asynchronous;
+    external = external_loop;
+}
 
 bool mqtt_init( const char* broker, int port, int keepalive) {
     bool success = true;
@@ -31,6 +266,10 @@ bool mqtt_init( const char* broker, int port, int keepalive) {
     mosquitto_lib_init();
     mosq = mosquitto_new(NULL, true, NULL);
     if(mosq){
+        mosquitto_connect_callback_set(mosq, on_connect);
+        mosquitto_disconnect_callback_set(mosq, on_disconnect);
+        mosquitto_publish_callback_set(mosq, on_publish);
+        mosquitto_max_inflight_messages_set(mosq, window);
         err = mosquitto_connect(mosq, broker, port, keepalive);
         if( err != MOSQ_ERR_SUCCESS ) {
             fprintf(stderr, "Error: mosquitto_connect [%s]\n", mosquitto_strerror(err));
@@ -41,35 +280,292 @@ bool mqtt_init( const char* broker, int port, int keepalive) {
         success = false;
     }
     
-    err = mosquitto_loop_start(mosq);
-    if( err != MOSQ_ERR_SUCCESS ) {
-        fprintf(stderr, "Error: mosquitto_connect [%s]\n", mosquitto_strerror(err));
-        success = false;
+    if ( !external ) {
+        err = mosquitto_loop_start(mosq);
+        if( err != MOSQ_ERR_SUCCESS ) {
+            fprintf(stderr, "Error: mosquitto_connect [%s]\n", mosquitto_strerror(err));
+            success = false;
+        }
+    }
+
+    if ( success && async ) {
+        queue = calloc(MQTT_QUEUE, sizeof(mqtt_slot_t));
+        atomic_init(&queue_head, 0);
+        atomic_init(&queue_tail, 0);
+        sem_init(&queue_sem, 0, 0);
+        publisher_running = true;
+        if ( !queue || pthread_create(&publisher, NULL, mqtt_publisher, NULL) ) {
+            fprintf(stderr, "Error: could not start publisher thread\n");
+            publisher_running = false;
+            success = false;
+        }
     }
     return success;
 }
 
 void mqtt_end( void ) {
-    mosquitto_loop_stop(mosq, true);
+    if ( publisher_running ) {
+        publisher_running = false;
+        sem_post(&queue_sem);
+        pthread_mutex_lock(&inflight_lock);
+        pthread_cond_signal(&inflight_cond);
+        pthread_mutex_unlock(&inflight_lock);
+        pthread_join(publisher, NULL);
+        sem_destroy(&queue_sem);
+    }
+    if ( queue ) {
+        for ( size_t i=0; i<MQTT_QUEUE; i++ ) {
+            free(queue[i].heap);
+        }
+        free(queue);
+        queue = NULL;
+    }
+    if ( !external ) {
+        mosquitto_loop_stop(mosq, true);
+    }
     mosquitto_destroy(mosq);
     mosquitto_lib_cleanup();
     mosq = NULL;
+    connected = false;
+    lost      = false;
+}
+
+bool mqtt_connected ( void ) {
+    return mosq && connected;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Counters to notice what happened between two looks: mqtt_connects() goes up with every
+ * accepted (re)connect, mqtt_generation() with every socket mqtt_service() opens, which
+ * mostly gets the file descriptor number of the one closed before
+ * ---------------------------------------------------------------------------------------
+ */
+uint32_t mqtt_connects ( void ) {
+    return atomic_load_explicit(&connects, memory_order_acquire);
+}
+
+uint32_t mqtt_generation ( void ) {
+    return atomic_load_explicit(&generation, memory_order_relaxed);
+}
+
+int mqtt_socket ( void ) {
+    return mosq ? mosquitto_socket(mosq) : -1;
+}
+
+bool mqtt_want_write ( void ) {
+    return mosq && mosquitto_want_write(mosq);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * One turn of the network loop: read and write what the socket allows, keepalive, and
+ * try to reconnect (at most once a second) once the connection is gone
+ * ---------------------------------------------------------------------------------------
+ */
+void mqtt_service ( bool readable, bool writable ) {
+    static uint64_t last_attempt = 0;
+    int             err = MOSQ_ERR_SUCCESS;
+
+    if ( !mosq ) {
+        return;
+    }
+    if ( readable ) {
+        err = mosquitto_loop_read(mosq, 1);
+    }
+    if ( err == MOSQ_ERR_SUCCESS && writable ) {
+        err = mosquitto_loop_write(mosq, 1);
+    }
+    if ( err == MOSQ_ERR_SUCCESS ) {
+        err = mosquitto_loop_misc(mosq);
+    }
+
+    if ( err != MOSQ_ERR_SUCCESS || mosquitto_socket(mosq) == -1 ) {
+        uint64_t now = stats_timestamp();
+
+        if ( connected ) {
+            on_disconnect(mosq, NULL, err);
+        }
+        if ( now - last_attempt >= 1000000 ) {
+            last_attempt = now;
+            err = mosquitto_reconnect(mosq);
+            atomic_fetch_add_explicit(&generation, 1, memory_order_relaxed);
+            if ( err != MOSQ_ERR_SUCCESS ) {
+                fprintf(stderr, "Error: mosquitto_reconnect [%s]\n", mosquitto_strerror(err));
+            }
+        }
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Queue a message for the publisher thread, never blocks. Fails if the connection to the
+ * broker was lost or the queue is full, so the caller can keep the reading. Messages
+ * queued while the first connect is still under way go out once it completes.
+ * ---------------------------------------------------------------------------------------
+ */
+static bool mqtt_enqueue ( const char *topic, const void *payload, size_t payload_length, bool retain,
+                           uint32_t ticket ) {
+    size_t      tail, depth;
+    size_t      topic_length   = strlen(topic);
+    mqtt_slot_t *slot;
+    char        *data;
+
+    if ( lost ) {
+        stats.dropped++;
+        return false;
+    }
+    tail  = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+    depth = tail - atomic_load_explicit(&queue_head, memory_order_acquire);
+    if ( depth >= MQTT_QUEUE ) {
+        stats.dropped++;
+        return false;
+    }
+
+    slot = &queue[tail & (MQTT_QUEUE-1)];
+    data = slot->data;
+    if ( topic_length + payload_length + 2 > MQTT_SLOT ) {
+        data = slot->heap = malloc(topic_length + payload_length + 2);
+        if ( !data ) {
+            stats.dropped++;
+            return false;
+        }
+    }
+    memcpy(data, topic, topic_length + 1);
+    memcpy(data + topic_length + 1, payload, payload_length);
+    slot->topic_length   = topic_length;
+    slot->payload_length = payload_length;
+    slot->retain         = retain;
+    slot->queued         = stats_timestamp();
+    slot->ticket         = ticket;
+
+    atomic_store_explicit(&queue_tail, tail + 1, memory_order_release);
+    sem_post(&queue_sem);
+
+    stats.queued++;
+    stats_record(STATS_QUEUE_DEPTH, depth + 1);
+    if ( depth + 1 > stats.depth_max ) {
+        stats.depth_max = depth + 1;
+    }
+    return true;
 }
 
 bool mqtt_publish ( const char *topic, const char *message ) {
+    return mqtt_publish_data(topic, message, strlen(message));
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Same for payloads that are not strings (binary payload formats)
+ * ---------------------------------------------------------------------------------------
+ */
+bool mqtt_publish_data ( const char *topic, const void *payload, size_t length ) {
+    return mqtt_publish_message(topic, payload, length, false);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Hand a message to the publisher thread (asynchronous mode) or to mosquitto
+ * ---------------------------------------------------------------------------------------
+ */
+static bool mqtt_send ( const char *topic, const void *payload, size_t length, bool retain, uint32_t ticket ) {
     bool success = true;
-    int  err;
+    int  err, mid = 0;
 
-    if ( mosq ) {
-        err = mosquitto_publish( mosq, NULL, topic, strlen(message), message, 0, false);
+    if ( mosq && async ) {
+        success = mqtt_enqueue(topic, payload, length, retain, ticket);
+    } else if ( mosq ) {
+        uint64_t start = stats_timestamp();
+        err = mosquitto_publish( mosq, &mid, topic, length, payload, qos, retain);
         if ( err != MOSQ_ERR_SUCCESS) {
             fprintf(stderr, "Error: mosquitto_publish failed [%s]\n", mosquitto_strerror(err));
+            stats.failed++;
             success = false;
+        } else {
+            stats.published++;
+            stats_record(STATS_PUBLISH, stats_timestamp() - start);
+        }
+        if ( ticket ) {
+            track_sent(ticket, mid, success);
         }
-        mosquitto_loop(mosq, 0, 1);
     } else {
         fprintf(stderr, "Error: mosq == NULL, Init failed?\n");
         success = false;
     }
     return success;
 }
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * ... and with the retain flag, so the broker hands it to everyone subscribing later
+ * ---------------------------------------------------------------------------------------
+ */
+bool mqtt_publish_message ( const char *topic, const void *payload, size_t length, bool retain ) {
+    return mqtt_send(topic, payload, length, retain, 0);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * ... and with a ticket for mqtt_delivery(), not retained
+ * ---------------------------------------------------------------------------------------
+ */
+bool mqtt_publish_tracked ( const char *topic, const void *payload, size_t length, uint32_t *ticket ) {
+    mqtt_track_t *entry;
+
+    pthread_mutex_lock(&inflight_lock);
+    *ticket = next_ticket++;
+    if ( next_ticket == 0 ) {
+        next_ticket = 1;
+    }
+    entry = &tracked[*ticket & (MQTT_TRACKED-1)];
+    entry->ticket = *ticket;
+    entry->mid    = 0;
+    entry->state  = TRACK_QUEUED;
+    pthread_mutex_unlock(&inflight_lock);
+
+    return mqtt_send(topic, payload, length, false, *ticket);
+}
+
+mqtt_delivery_t mqtt_delivery ( uint32_t ticket ) {
+    mqtt_track_t    *entry = &tracked[ticket & (MQTT_TRACKED-1)];
+    mqtt_delivery_t delivery;
+
+    pthread_mutex_lock(&inflight_lock);
+    if ( entry->ticket != ticket || entry->state == TRACK_FAILED ) {
+        delivery = MQTT_FAILED;
+    } else if ( entry->state == TRACK_DELIVERED ) {
+        delivery = MQTT_DELIVERED;
+    } else {
+        delivery = MQTT_PENDING;
+    }
+    pthread_mutex_unlock(&inflight_lock);
+    return delivery;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Bytes a PUBLISH packet takes on the wire: fixed header with variable length
+ * remaining length field, topic length, topic, packet id for QoS > 0 and payload
+ * ---------------------------------------------------------------------------------------
+ */
+size_t mqtt_packet_size ( size_t topic, size_t payload ) {
+    size_t remaining = 2 + topic + (qos ? 2 : 0) + payload;
+    size_t size      = 1 + 1 + remaining;
+
+    while ( remaining > 127 ) {
+        remaining /= 128;
+        size++;
+    }
+    return size;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Publishing counters and current queue depth
+ * ---------------------------------------------------------------------------------------
+ */
+void mqtt_stats ( mqtt_stats_t *copy ) {
+    *copy = stats;
+    copy->depth = queue ? atomic_load(&queue_tail) - atomic_load(&queue_head) : 0;
+    copy->inflight = inflight;
+}
@@ -25,11 +25,58 @@
 
 #include <mosquitto.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 
+typedef struct {
+    uint32_t  queued;                           /* messages accepted by the queue      */
+    uint32_t  dropped;                          /* rejected: queue full / no broker    */
+    uint32_t  published;                        /* handed to mosquitto                 */
+    uint32_t  failed;                           /* mosquitto_publish() failed          */
+    uint32_t  retried;                          /* kept for the reconnect, no broker   */
+    uint32_t  window_full;                      /* publisher had to wait for PUBACKs   */
+    uint32_t  depth;                            /* messages waiting in the queue       */
+    uint32_t  depth_max;
+    uint32_t  inflight;                         /* unacknowledged QoS 1/2 messages     */
+    uint32_t  inflight_max;
+} mqtt_stats_t;
+
+void mqtt_setup(int qos, unsigned int inflight, bool async, bool external);
 bool mqtt_init(const char* broker, int port, int keepalive);
 void mqtt_end(void );
 bool mqtt_publish (const char *topic, const char *message);
+bool mqtt_publish_data (const char *topic, const void *payload, size_t length);
+bool mqtt_publish_message (const char *topic, const void *payload, size_t length, bool retain);
+bool mqtt_publish_tracked (const char *topic, const void *payload, size_t length, uint32_t *ticket);
+size_t mqtt_packet_size (size_t topic, size_t payload);
+bool mqtt_connected (void);
+uint32_t mqtt_connects (void);
+void mqtt_stats (mqtt_stats_t *stats);
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Messages published with mqtt_publish_tracked() get a ticket to ask whether the broker
+ * has them: acknowledged with QoS > 0, handed to mosquitto with QoS 0. Only the last
+ * MQTT_TRACKED tickets are remembered, older ones read as failed.
+ * ---------------------------------------------------------------------------------------
+ */
+#define MQTT_TRACKED  64                        /* must be a power of two              */
+
+typedef enum { MQTT_PENDING, MQTT_DELIVERED, MQTT_FAILED } mqtt_delivery_t;
+
+mqtt_delivery_t mqtt_delivery (uint32_t ticket);
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * With an external event loop (mqtt_setup(..., external=true)) there is no mosquitto
+ * network thread: wait for mqtt_socket() to become readable, or writable while
+ * mqtt_want_write(), and call mqtt_service() then and at least once a second.
+ * ---------------------------------------------------------------------------------------
+ */
+int  mqtt_socket (void);
+bool mqtt_want_write (void);
+void mqtt_service (bool readable, bool writable);
+uint32_t mqtt_generation (void);
 
 #endif /* MQTT_h */
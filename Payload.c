@@ -0,0 +1,142 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "Payload.h"
+
+#define CBOR_UINT    0                          /* major types                         */
+#define CBOR_ARRAY   4
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Initial byte and argument of a data item, big endian as CBOR wants it
+ * ---------------------------------------------------------------------------------------
+ */
+static size_t cbor_head( uint8_t *buffer, uint8_t major, uint64_t value ) {
+    major <<= 5;
+    if ( value < 24 ) {
+        buffer[0] = major | value;
+        return 1;
+    } else if ( value <= UINT8_MAX ) {
+        buffer[0] = major | 24;
+        buffer[1] = value;
+        return 2;
+    } else if ( value <= UINT16_MAX ) {
+        buffer[0] = major | 25;
+        buffer[1] = value >> 8;
+        buffer[2] = value;
+        return 3;
+    } else if ( value <= UINT32_MAX ) {
+        buffer[0] = major | 26;
+        for ( int i=0; i<4; i++ ) {
+            buffer[1+i] = value >> (24 - 8*i);
+        }
+        return 5;
+    }
+    buffer[0] = major | 27;
+    for ( int i=0; i<8; i++ ) {
+        buffer[1+i] = value >> (56 - 8*i);
+    }
+    return 9;
+}
+
+size_t payload_cbor( uint8_t *buffer, const payload_reading_t *reading ) {
+    size_t length = cbor_head(buffer, CBOR_ARRAY, 4);
+
+    length += cbor_head(buffer+length, CBOR_UINT, reading->index);
+    length += cbor_head(buffer+length, CBOR_UINT, reading->value);
+    length += cbor_head(buffer+length, CBOR_UINT, reading->time);
+    length += cbor_head(buffer+length, CBOR_UINT, reading->flags);
+    return length;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * A batch is its header, then payload_cbor_entry() for each of the 'count' readings
+ * ---------------------------------------------------------------------------------------
+ */
+size_t payload_cbor_batch( uint8_t *buffer, size_t count, uint64_t time ) {
+    size_t length = cbor_head(buffer, CBOR_ARRAY, 1 + 4 * (uint64_t)count);
+
+    return length + cbor_head(buffer+length, CBOR_UINT, time);
+}
+
+size_t payload_cbor_entry( uint8_t *buffer, const payload_reading_t *reading, uint64_t time ) {
+    size_t length = cbor_head(buffer, CBOR_UINT, reading->index);
+
+    length += cbor_head(buffer+length, CBOR_UINT, reading->value);
+    length += cbor_head(buffer+length, CBOR_UINT, reading->time - time);
+    length += cbor_head(buffer+length, CBOR_UINT, reading->flags);
+    return length;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * A reading (its value is the last one of the window) followed by the window summary
+ * ---------------------------------------------------------------------------------------
+ */
+size_t payload_cbor_summary( uint8_t *buffer, const payload_reading_t *reading,
+                             const aggregate_summary_t *summary ) {
+    size_t length = cbor_head(buffer, CBOR_ARRAY, 9);
+
+    length += cbor_head(buffer+length, CBOR_UINT, reading->index);
+    length += cbor_head(buffer+length, CBOR_UINT, reading->value);
+    length += cbor_head(buffer+length, CBOR_UINT, reading->time);
+    length += cbor_head(buffer+length, CBOR_UINT, reading->flags);
+    length += cbor_head(buffer+length, CBOR_UINT, summary->min);
+    length += cbor_head(buffer+length, CBOR_UINT, summary->max);
+    length += cbor_head(buffer+length, CBOR_UINT, summary->mean);
+    length += cbor_head(buffer+length, CBOR_UINT, summary->count);
+    length += cbor_head(buffer+length, CBOR_UINT, summary->high);
+    return length;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * uint16_t to decimal text without going through printf, returns number of characters
+ * ---------------------------------------------------------------------------------------
+ */
+size_t payload_decimal( char *buffer, uint16_t value ) {
+    char   digits[5];
+    size_t count = 0, length;
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while ( value );
+
+    length = count;
+    while ( count ) {
+        *buffer++ = digits[--count];
+    }
+    return length;
+}
+
+size_t payload_json( char *buffer, const char *json, size_t json_length, uint16_t value ) {
+    size_t length = json_length;
+
+    memcpy(buffer, json, length);
+    length += payload_decimal(buffer+length, value);
+    memcpy(buffer+length, "\"}", 3);
+    return length + 2;
+}
@@ -0,0 +1,79 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Payload_h
+#define Payload_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Aggregate.h"
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Binary payloads in CBOR (RFC 8949), encoded straight into the caller's buffer. Every
+ * number takes the shortest form CBOR has for it (1, 2, 3, 5 or 9 bytes).
+ *   reading   [index, value, time, flags]
+ *   batch     [time, index, value, dt, flags, index, value, dt, flags, ...]
+ *             with dt the time of each reading relative to the first one
+ *   summary   [index, last, time, flags, min, max, mean, count, high]
+ *             for aggregated sensors, mean * 1000 and high in msecs
+ * time is msecs on CLOCK_MONOTONIC, for resent readings (PAYLOAD_RESENT) msecs since
+ * the epoch. index is the position of the SENSOR line in the configuration.
+ * ---------------------------------------------------------------------------------------
+ */
+#define PAYLOAD_FULL_REPORT  0x01               /* part of a full report, no change    */
+#define PAYLOAD_DEBOUNCED    0x02               /* passed the sensor's debounce filter */
+#define PAYLOAD_RESENT       0x04               /* from the spool, time is wall clock  */
+#define PAYLOAD_SUMMARY      0x08               /* window summary of an aggregated one */
+
+#define PAYLOAD_READING_MAX  20                 /* bytes, largest encoded reading      */
+#define PAYLOAD_BATCH_MAX    14                 /* bytes, batch without its readings   */
+#define PAYLOAD_ENTRY_MAX    20                 /* bytes, largest reading in a batch   */
+#define PAYLOAD_SUMMARY_MAX  46                 /* bytes, largest encoded summary      */
+
+typedef struct {
+    uint32_t  index;
+    uint16_t  value;
+    uint8_t   flags;
+    uint64_t  time;                             /* msecs                               */
+} payload_reading_t;
+
+size_t   payload_cbor( uint8_t *buffer, const payload_reading_t *reading );
+size_t   payload_cbor_batch( uint8_t *buffer, size_t count, uint64_t time );
+size_t   payload_cbor_entry( uint8_t *buffer, const payload_reading_t *reading, uint64_t time );
+size_t   payload_cbor_summary( uint8_t *buffer, const payload_reading_t *reading,
+                               const aggregate_summary_t *summary );
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * JSON payloads from a template prepared once per sensor, '{"<label>":"', so a reading
+ * is a copy and the digits of its value: {"<label>":"<value>"}, NUL terminated. Batches
+ * are readings with the '{' of all but the first one replaced and the '}' dropped.
+ * ---------------------------------------------------------------------------------------
+ */
+size_t   payload_decimal( char *buffer, uint16_t value );
+size_t   payload_json( char *buffer, const char *json, size_t json_length, uint16_t value );
+
+#endif /* Payload_h */
@@ -0,0 +1,171 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RPISensorClient.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Payload benchmark: size and encode time of a reading in each payload format
+ *   sprintf   {"<label>":"<value>"} with sprintf()
+ *   json      the same, the way rpisensorclient renders it (prefix prepared once)
+ *   json+     JSON with everything the binary format carries: index, time and flags
+ *   cbor      PAYLOAD_FORMAT CBOR, [index, value, time, flags]
+ * and of batches of 8 and 64 changes, JSON as {"<label>":"<value>",...}. Sizes are
+ * payload bytes, averaged over labels and values as they show up in the field.
+ * ---------------------------------------------------------------------------------------
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "Payload.h"
+
+#define BENCH_ROUNDS   (4*1024*1024)            /* readings encoded per measurement    */
+#define BENCH_UPTIME   (3*86400*1000ULL)        /* msecs, CLOCK_MONOTONIC of a reading */
+#define BENCH_SENSORS  8
+
+static const char *labels[BENCH_SENSORS] = { "PIR", "LGT", "TMP", "HMD", "DOOR", "WINDOW", "GARAGE", "PUMP" };
+static const uint16_t values[BENCH_SENSORS] = { 1, 0, 21, 48, 1, 0, 1, 0 };
+
+volatile uint64_t sink;                         /* keeps results from being optimized  */
+
+uint64_t bench_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * The encoders, each returns the payload length
+ * ---------------------------------------------------------------------------------------
+ */
+size_t encodeSprintf(char *buffer, const payload_reading_t *reading) {
+    return sprintf(buffer, "{\"%s\":\"%u\"}", labels[reading->index], reading->value);
+}
+
+size_t encodeJson(char *buffer, const payload_reading_t *reading, char **json, size_t *json_length) {
+    return payload_json(buffer, json[reading->index], json_length[reading->index], reading->value);
+}
+
+size_t encodeJsonFull(char *buffer, const payload_reading_t *reading) {
+    return sprintf(buffer, "{\"%s\":\"%u\",\"index\":%u,\"time\":%llu,\"flags\":%u}",
+                   labels[reading->index], reading->value, reading->index,
+                   (unsigned long long)reading->time, reading->flags);
+}
+
+size_t encodeCbor(char *buffer, const payload_reading_t *reading) {
+    return payload_cbor((uint8_t*)buffer, reading);
+}
+
+size_t batchJson(char *buffer, const payload_reading_t *readings, size_t count, char **json, size_t *json_length) {
+    size_t length = 0;
+
+    for ( size_t i=0; i<count; i++ ) {
+        size_t start = length;
+
+        length += encodeJson(buffer+length, &readings[i], json, json_length) - 1;
+        buffer[start] = i ? ',' : '{';
+    }
+    buffer[length++] = '}';
+    return length;
+}
+
+size_t batchCbor(char *buffer, const payload_reading_t *readings, size_t count) {
+    size_t length = payload_cbor_batch((uint8_t*)buffer, count, readings[0].time);
+
+    for ( size_t i=0; i<count; i++ ) {
+        length += payload_cbor_entry((uint8_t*)buffer+length, &readings[i], readings[0].time);
+    }
+    return length;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * M A I N
+ * ---------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[]) {
+    static const char *names[] = { "sprintf", "json", "json+", "cbor" };
+    static const size_t batches[] = { 8, 64 };
+    payload_reading_t readings[64];
+    char              *json[BENCH_SENSORS];
+    size_t            json_length[BENCH_SENSORS];
+    char              buffer[4096];
+
+    for ( int i=0; i<BENCH_SENSORS; i++ ) {
+        json_length[i] = asprintf(&json[i], "{\"%s\":\"", labels[i]);
+    }
+    for ( int i=0; i<64; i++ ) {
+        readings[i].index = i % BENCH_SENSORS;
+        readings[i].value = values[i % BENCH_SENSORS];
+        readings[i].flags = (i % 3 == 0) ? PAYLOAD_DEBOUNCED : 0;
+        readings[i].time  = BENCH_UPTIME + i * 37;
+    }
+
+    printf("%-12s %9s %9s\n", "format", "bytes", "ns/msg");
+    for ( int format=0; format<4; format++ ) {
+        uint64_t bytes = 0, start;
+
+        for ( int i=0; i<BENCH_SENSORS; i++ ) {
+            switch ( format ) {
+                case 0: bytes += encodeSprintf(buffer, &readings[i]); break;
+                case 1: bytes += encodeJson(buffer, &readings[i], json, json_length); break;
+                case 2: bytes += encodeJsonFull(buffer, &readings[i]); break;
+                case 3: bytes += encodeCbor(buffer, &readings[i]); break;
+            }
+        }
+        start = bench_timestamp();
+        for ( size_t round=0; round<BENCH_ROUNDS; round++ ) {
+            payload_reading_t *reading = &readings[round % BENCH_SENSORS];
+
+            switch ( format ) {
+                case 0: sink += encodeSprintf(buffer, reading); break;
+                case 1: sink += encodeJson(buffer, reading, json, json_length); break;
+                case 2: sink += encodeJsonFull(buffer, reading); break;
+                case 3: sink += encodeCbor(buffer, reading); break;
+            }
+        }
+        printf("%-12s %9.1f %9.1f\n", names[format], (double)bytes / BENCH_SENSORS,
+               (double)(bench_timestamp() - start) / BENCH_ROUNDS);
+    }
+
+    for ( int b=0; b<2; b++ ) {
+        size_t count  = batches[b];
+        size_t rounds = BENCH_ROUNDS / count;
+
+        for ( int format=1; format<4; format+=2 ) {
+            uint64_t start = bench_timestamp();
+            size_t   bytes = 0;
+
+            for ( size_t round=0; round<rounds; round++ ) {
+                bytes = (format == 1) ? batchJson(buffer, readings, count, json, json_length)
+                                      : batchCbor(buffer, readings, count);
+                sink += bytes;
+            }
+            printf("%-5s x%-6zu %9zu %9.1f\n", names[format], count, bytes,
+                   (double)(bench_timestamp() - start) / rounds);
+        }
+    }
+    return 0;
+}
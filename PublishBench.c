@@ -0,0 +1,129 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Publish path benchmark: messages per second rendering the topic and message of a changed
+ * reading, the way readSensor() did before the templates, sprintf() for both and strlen()
+ * for the length mosquitto needs, against the topic and '{"<label>":"' prefix rendered
+ * once and the value appended by payload_json(), as renderValue() does now. For short
+ * labels and for labels long enough to overflow the old 32 byte topic buffer (the bench
+ * gives it room).
+ * ---------------------------------------------------------------------------------------
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "Payload.h"
+
+#define BENCH_ROUNDS   (4*1024*1024)            /* messages rendered per measurement   */
+#define BENCH_SENSORS  8
+#define BENCH_PREFIX   "BB"
+#define BENCH_ID       "9c87"
+
+static const char *short_labels[BENCH_SENSORS] = { "PIR", "LGT", "TMP", "HMD", "DOOR", "WINDOW", "GARAGE", "PUMP" };
+static const char *long_labels[BENCH_SENSORS]  = {
+    "LIVINGROOM_MOTION", "LIVINGROOM_LIGHT", "BEDROOM_TEMPERATURE", "BEDROOM_HUMIDITY",
+    "FRONT_DOOR_CONTACT", "KITCHEN_WINDOW_LEFT", "GARAGE_DOOR_CONTACT", "BASEMENT_SUMP_PUMP" };
+static const int      pins[BENCH_SENSORS]   = { 12, 1, 3, 3, 16, 21, 22, 26 };
+static const uint16_t values[BENCH_SENSORS] = { 1, 0, 21, 48, 1, 0, 1, 0 };
+
+typedef struct {
+    const char *label;
+    int        pin;
+    char       *topic;
+    size_t     topic_length;
+    char       *json;
+    size_t     json_length;
+} bench_sensor_t;
+
+volatile uint64_t sink;                         /* keeps results from being optimized  */
+
+uint64_t bench_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Both paths, each returns topic and message length as mosquitto_publish() gets them
+ * ---------------------------------------------------------------------------------------
+ */
+size_t renderBefore(const bench_sensor_t *sensor, uint16_t value, char *topic, char *msg) {
+    sprintf(topic, "%s/%s-%s/%d", sensor->label, BENCH_PREFIX, BENCH_ID, sensor->pin);
+    sprintf(msg, "{\"%s\":\"%d\"}", sensor->label, value);
+    return strlen(topic) + strlen(msg);
+}
+
+size_t renderNow(const bench_sensor_t *sensor, uint16_t value, char *msg) {
+    return sensor->topic_length + payload_json(msg, sensor->json, sensor->json_length, value);
+}
+
+void runBench(const char *name, const char **labels) {
+    bench_sensor_t sensors[BENCH_SENSORS];
+    char           topic[128], msg[128];
+    double         nsecs[2];
+    uint64_t       start;
+
+    for ( int i=0; i<BENCH_SENSORS; i++ ) {
+        sensors[i].label        = labels[i];
+        sensors[i].pin          = pins[i];
+        sensors[i].topic_length = asprintf(&sensors[i].topic, "%s/%s-%s/%d", labels[i], BENCH_PREFIX, BENCH_ID, pins[i]);
+        sensors[i].json_length  = asprintf(&sensors[i].json, "{\"%s\":\"", labels[i]);
+    }
+
+    start = bench_timestamp();
+    for ( size_t round=0; round<BENCH_ROUNDS; round++ ) {
+        sink += renderBefore(&sensors[round % BENCH_SENSORS], values[round % BENCH_SENSORS] + round % 2, topic, msg);
+    }
+    nsecs[0] = (double)(bench_timestamp() - start) / BENCH_ROUNDS;
+    start = bench_timestamp();
+    for ( size_t round=0; round<BENCH_ROUNDS; round++ ) {
+        sink += renderNow(&sensors[round % BENCH_SENSORS], values[round % BENCH_SENSORS] + round % 2, msg);
+    }
+    nsecs[1] = (double)(bench_timestamp() - start) / BENCH_ROUNDS;
+
+    printf("%-8s %12.0f %12.0f %9.1f %9.1f\n", name, 1e9 / nsecs[0], 1e9 / nsecs[1], nsecs[0], nsecs[1]);
+    for ( int i=0; i<BENCH_SENSORS; i++ ) {
+        free(sensors[i].topic);
+        free(sensors[i].json);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * M A I N
+ * ---------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[]) {
+    printf("%-8s %12s %12s %9s %9s\n", "", "msgs/s", "", "ns/msg", "");
+    printf("%-8s %12s %12s %9s %9s\n", "labels", "before", "now", "before", "now");
+    runBench("short", short_labels);
+    runBench("long", long_labels);
+    return 0;
+}
@@ -0,0 +1,521 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RPISensorClient.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * End to end benchmark: runs the real rpisensorclient in the foreground on the simulated
+ * GPIO backend against a minimal MQTT broker built into this program.
+ *
+ * Every simulated pin toggles with a fixed period and a per pin phase, both derived from
+ * an epoch handed to the client (GPIO_SIM_EPOCH), so for every message received we know
+ * exactly when the change it reports happened. Reported per sensor count:
+ *   msgs/s       PUBLISH packets received per second
+ *   latency      change on the pin to PUBLISH at the broker, percentiles in msecs. For
+ *                polled sensors this includes waiting for the next read (up to -r).
+ *   jitter       deviation of the actual from the configured read interval, as measured
+ *                by the client itself
+ *   late         how far scheduled reads ran after their due time, averaged by the client
+ *   cpu          user+system time of the client relative to its run time
+ * With -H the client gets a SIGHUP every second and reloads its (unchanged) configuration,
+ * how long that took and how long the sensor loop stood still meanwhile is reported
+ * below each run.
+ * With -B polled sensors are read in bank mode (GPIO_BANK), all lines by one read.
+ * With -t every sensor count runs twice, with exact wakeups and with reads allowed to be
+ * that many msecs late (TOLERANCE), wake/s is how often the client's loop woke up and
+ * reads/wk how many scheduled reads each wakeup served. A run with tolerance that serves
+ * fewer reads per wakeup than the exact one did not merge them and fails the benchmark.
+ * With -s the broker is slow: it acknowledges every QoS 1/2 PUBLISH that many msecs
+ * late, so the client runs into its in-flight window (MQTT_INFLIGHT) and queue.
+ * ---------------------------------------------------------------------------------------
+ */
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Default settings - may be overwritten by command line options
+ * ---------------------------------------------------------------------------------------
+ */
+#define BENCH_DURATION   10                     /* secs per sensor count               */
+#define BENCH_PERIOD     1000                   /* msecs between toggles of a pin      */
+#define BENCH_POLL       100                    /* msecs between reads of a sensor     */
+#define BENCH_STARTUP    1000                   /* msecs before the first toggle       */
+#define BENCH_PINS       256
+#define BENCH_BUFFER     65536
+#define BENCH_ACKS       65536                  /* acknowledgements held back, -s      */
+
+unsigned int duration   = BENCH_DURATION;
+unsigned int period     = BENCH_PERIOD;
+unsigned int poll_freq  = BENCH_POLL;
+bool         edge       = false;
+bool         async      = false;
+bool         reactor    = false;
+bool         reload     = false;
+bool         bank       = false;
+unsigned int tolerance  = 0;                    /* msecs, -t                           */
+unsigned int ack_delay  = 0;                    /* msecs, -s                           */
+int          qos        = 0;
+char         *client    = NULL;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Results of one run
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint64_t  epoch;                            /* usec, CLOCK_MONOTONIC               */
+    uint64_t  messages;
+    uint64_t  late;                             /* could not be matched to a change    */
+    uint32_t  *latency;                         /* usec                                */
+    size_t    count;
+    size_t    size;
+    size_t    fill;                             /* bytes of an incomplete packet       */
+} benchRun_t;
+
+uint64_t bench_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+uint64_t pinPhase(unsigned int pin) {
+    return (uint64_t)pin * period / BENCH_PINS * 1000;   /* whole msecs, as configured */
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Configuration for 'sensors' DIGITAL sensors spread over all simulated pins
+ * ---------------------------------------------------------------------------------------
+ */
+bool writeConfig(const char *path, unsigned int sensors, int port, uint64_t epoch, unsigned int lateness) {
+    FILE *fp = fopen(path, "w");
+
+    if ( !fp ) {
+        fprintf(stderr, "Error: could not write %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    fprintf(fp, "MQTT_BROKER_IP 127.0.0.1\n");
+    fprintf(fp, "MQTT_BROKER_PORT %d\n", port);
+    fprintf(fp, "MQTT_INTERFACE lo\n");
+    fprintf(fp, "MQTT_QOS %d\n", qos);
+    fprintf(fp, "MQTT_ASYNC %d\n", async);
+    fprintf(fp, "REACTOR %d\n", reactor);
+    fprintf(fp, "REPORT_CYCLE 360000\n");
+    fprintf(fp, "GPIO_BACKEND SIM\n");
+    fprintf(fp, "GPIO_BANK %d\n", bank);
+    fprintf(fp, "GPIO_SIM_EPOCH %llu\n", (unsigned long long)epoch);
+    for ( unsigned int pin=0; pin<BENCH_PINS && pin<sensors; pin++ ) {
+        fprintf(fp, "SIM_TOGGLE %u %u %llu\n", pin, period, (unsigned long long)pinPhase(pin)/1000);
+        if ( lateness ) {
+            fprintf(fp, "TOLERANCE %u %u\n", pin, lateness);
+        }
+    }
+    for ( unsigned int index=0; index<sensors; index++ ) {
+        fprintf(fp, "SENSOR %u DIGITAL 0 %u S%u%s\n", index % BENCH_PINS, poll_freq/10, index,
+                edge ? " EDGE" : "");
+    }
+    fclose(fp);
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * A message arrived: <label>/<prefix>-<id>/<pin> {"<label>":"<value>"}. The pin's level
+ * is (time since epoch+phase) / period & 1, so the change reported is the latest toggle
+ * to that level.
+ * ---------------------------------------------------------------------------------------
+ */
+void recordMessage(benchRun_t *run, const char *topic, size_t topic_length,
+                   const char *payload, size_t payload_length, uint64_t now) {
+    const char *slash = memrchr(topic, '/', topic_length);
+    const char *value = memmem(payload, payload_length, "\":\"", 3);
+    uint64_t   start, cycle;
+    unsigned   pin;
+
+    run->messages++;
+    if ( !slash || !value ) {
+        return;
+    }
+    pin   = atoi(slash+1);
+    start = run->epoch + pinPhase(pin);
+    if ( now < start + (uint64_t)period*1000 ) {
+        return;                                     /* initial report, not a change    */
+    }
+    cycle = (now - start) / (period*1000ULL);
+    if ( (cycle & 1) != (uint64_t)(value[3] == '1') ) {
+        cycle--;                                    /* level changed again meanwhile   */
+    }
+    if ( cycle == 0 ) {
+        run->late++;
+        return;
+    }
+    if ( run->count == run->size ) {
+        size_t   size = run->size ? 2*run->size : 4096;
+        uint32_t *list = realloc(run->latency, size*sizeof(uint32_t));
+        if ( !list ) {
+            return;
+        }
+        run->latency = list;
+        run->size    = size;
+    }
+    run->latency[run->count++] = now - (start + cycle*period*1000ULL);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Slow broker: PUBACK/PUBREC packets wait here until they are due
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint64_t  due;                              /* usec, CLOCK_MONOTONIC               */
+    uint8_t   reply[4];
+} benchAck_t;
+
+benchAck_t ack_queue[BENCH_ACKS];
+size_t     ack_head = 0, ack_tail = 0;
+
+void holdAck(const uint8_t *reply, uint64_t now) {
+    if ( ack_tail - ack_head < BENCH_ACKS ) {
+        benchAck_t *ack = &ack_queue[ack_tail++ % BENCH_ACKS];
+        ack->due = now + ack_delay*1000ULL;
+        memcpy(ack->reply, reply, 4);
+    }
+}
+
+uint64_t sendAcks(int fd, uint64_t now) {
+    while ( ack_head != ack_tail && ack_queue[ack_head % BENCH_ACKS].due <= now ) {
+        if ( write(fd, ack_queue[ack_head % BENCH_ACKS].reply, 4) != 4 ) {
+            fprintf(stderr, "Error: write to client [%s]\n", strerror(errno));
+        }
+        ack_head++;
+    }
+    return ack_head != ack_tail ? ack_queue[ack_head % BENCH_ACKS].due : UINT64_MAX;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Just enough MQTT 3.1.1 broker: acknowledge CONNECT, PUBLISH (QoS 1 and 2), PUBREL and
+ * PINGREQ. Returns the number of bytes consumed, 0 if the packet is incomplete.
+ * ---------------------------------------------------------------------------------------
+ */
+size_t handlePacket(int fd, benchRun_t *run, uint8_t *buffer, size_t fill) {
+    size_t  remaining = 0, header = 1;
+    int     shift = 0;
+    uint8_t reply[4];
+    size_t  reply_length = 0;
+
+    do {
+        if ( header >= fill ) {
+            return 0;
+        }
+        remaining |= (size_t)(buffer[header] & 0x7F) << shift;
+        shift += 7;
+    } while ( buffer[header++] & 0x80 );
+    if ( header + remaining > fill ) {
+        return 0;
+    }
+
+    uint8_t *body = buffer + header;
+    switch ( buffer[0] >> 4 ) {
+        case 1:                                     /* CONNECT -> CONNACK              */
+            memcpy(reply, "\x20\x02\x00\x00", 4);
+            reply_length = 4;
+            break;
+        case 3: {                                   /* PUBLISH -> PUBACK / PUBREC      */
+            int    level  = (buffer[0] >> 1) & 3;
+            size_t length = (body[0] << 8) | body[1];
+            size_t offset = 2 + length + (level ? 2 : 0);
+
+            recordMessage(run, (char*)body+2, length, (char*)body+offset, remaining-offset,
+                          bench_timestamp());
+            if ( level ) {
+                reply[0] = (level == 1) ? 0x40 : 0x50;
+                reply[1] = 2;
+                reply[2] = body[2+length];
+                reply[3] = body[3+length];
+                reply_length = 4;
+                if ( ack_delay ) {
+                    holdAck(reply, bench_timestamp());
+                    reply_length = 0;
+                }
+            }
+            break;
+        }
+        case 6:                                     /* PUBREL -> PUBCOMP               */
+            reply[0] = 0x70;
+            reply[1] = 2;
+            reply[2] = body[0];
+            reply[3] = body[1];
+            reply_length = 4;
+            break;
+        case 12:                                    /* PINGREQ -> PINGRESP             */
+            memcpy(reply, "\xD0\x00", 2);
+            reply_length = 2;
+            break;
+        default:
+            break;
+    }
+    if ( reply_length && write(fd, reply, reply_length) != (ssize_t)reply_length ) {
+        fprintf(stderr, "Error: write to client [%s]\n", strerror(errno));
+    }
+    return header + remaining;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Serve the client until 'until', returns false if it went away
+ * ---------------------------------------------------------------------------------------
+ */
+bool serveClient(int fd, benchRun_t *run, uint64_t until) {
+    static uint8_t buffer[BENCH_BUFFER];
+    size_t         fill = run->fill;
+
+    for ( uint64_t now=bench_timestamp(); now<until; now=bench_timestamp() ) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        uint64_t      wakeup = sendAcks(fd, now);
+        ssize_t       length;
+        size_t        used;
+
+        if ( wakeup > until ) {
+            wakeup = until;
+        }
+        if ( poll(&pfd, 1, wakeup > now ? (wakeup - now + 999) / 1000 : 0) <= 0 ) {
+            continue;
+        }
+        length = read(fd, buffer+fill, sizeof(buffer)-fill);
+        if ( length <= 0 ) {
+            return false;
+        }
+        fill += length;
+        while ( (used = handlePacket(fd, run, buffer, fill)) ) {
+            fill -= used;
+            memmove(buffer, buffer+used, fill);
+        }
+        run->fill = fill;
+    }
+    return true;
+}
+
+int compareLatency(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+double percentile(benchRun_t *run, double p) {
+    if ( run->count == 0 ) {
+        return 0;
+    }
+    return run->latency[(size_t)(p * (run->count-1))] / 1000.0;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * One benchmark run with 'sensors' sensors
+ * ---------------------------------------------------------------------------------------
+ */
+bool runBench(int listener, int port, unsigned int sensors, unsigned int lateness, double *served) {
+    char          config[64], summary[256] = "";
+    benchRun_t    run;
+    struct rusage usage;
+    int           out[2], status, fd;
+    uint64_t      started, stopped, stop;
+    unsigned long long samples = 0, jitter_avg = 0, jitter_max = 0, late_avg = 0;
+    unsigned long long reload_latency = 0, reload_silence = 0, wakeups = 0;
+    unsigned int  reloads = 0;
+    char          *tail;
+    struct pollfd pfd = { listener, POLLIN, 0 };
+    pid_t         pid;
+    double        cpu;
+
+    memset(&run, 0, sizeof(run));
+    snprintf(config, sizeof(config), "/tmp/rpisensorbench-%d.cfg", getpid());
+    started   = bench_timestamp();
+    run.epoch = started + BENCH_STARTUP*1000ULL;
+    if ( !writeConfig(config, sensors, port, run.epoch, lateness) || pipe(out) == -1 ) {
+        return false;
+    }
+
+    pid = fork();
+    if ( pid == 0 ) {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        execl(client, client, "-f", "-c", config, (char*)NULL);
+        fprintf(stderr, "Error: could not run %s [%s]\n", client, strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+    close(out[1]);
+    if ( pid < 0 || poll(&pfd, 1, 10000) != 1 || (fd = accept(listener, NULL, NULL)) == -1 ) {
+        fprintf(stderr, "Error: client did not connect\n");
+        if ( pid > 0 ) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        close(out[0]);
+        unlink(config);
+        return false;
+    }
+
+    stop = run.epoch + duration*1000000ULL;
+    for ( uint64_t next=run.epoch+500000; reload && next<stop; next+=1000000 ) {
+        serveClient(fd, &run, next);
+        kill(pid, SIGHUP);
+    }
+    serveClient(fd, &run, stop);
+    kill(pid, SIGTERM);
+    serveClient(fd, &run, bench_timestamp() + 200000);
+    wait4(pid, &status, 0, &usage);
+    stopped = bench_timestamp();
+    close(fd);
+    ack_head = ack_tail = 0;
+    unlink(config);
+
+    if ( read(out[0], summary, sizeof(summary)-1) > 0 ) {
+        sscanf(summary, "Sampled %llu times, jitter avg %llu max %llu usec, late avg %llu",
+               &samples, &jitter_avg, &jitter_max, &late_avg);
+        if ( (tail = strstr(summary, "messages, ")) ) {
+            sscanf(tail, "messages, %u reloads, latency max %llu usec, silence max %llu usec, %llu wakeups",
+                   &reloads, &reload_latency, &reload_silence, &wakeups);
+        }
+    }
+    close(out[0]);
+
+    qsort(run.latency, run.count, sizeof(uint32_t), compareLatency);
+    cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e6 +
+          usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+    *served = wakeups ? (double)samples / wakeups : 0.0;
+    printf("%7u %5u %9.0f %9.2f %9.2f %9.2f %9.2f %9llu %9llu %9llu %9.0f %8.2f %7.1f\n",
+           sensors, lateness,
+           run.messages * 1e6 / (stopped - run.epoch),
+           percentile(&run, 0.5), percentile(&run, 0.9), percentile(&run, 0.99), percentile(&run, 1.0),
+           jitter_avg, jitter_max, late_avg,
+           wakeups * 1e6 / (stopped - started), *served,
+           100.0 * cpu / (stopped - started));
+    if ( reload ) {
+        printf("        %u reloads, latency max %.2f ms, sensor loop stopped max %.2f ms\n",
+               reloads, reload_latency / 1000.0, reload_silence / 1000.0);
+    }
+    if ( run.late ) {
+        printf("        %llu messages could not be matched to a change\n", (unsigned long long)run.late);
+    }
+    fflush(stdout);
+    free(run.latency);
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * M A I N
+ * ---------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[]) {
+    unsigned int       counts[32] = { 1, 10, 100, 1000, 10000 };
+    int                num_counts = 0, opt, listener, port, result = EXIT_SUCCESS;
+    double             exact, merged;
+    struct sockaddr_in addr;
+    socklen_t          addr_length = sizeof(addr);
+
+    while ( (opt = getopt(argc, argv, "d:p:r:q:x:t:s:eaRHB")) != -1 ) {
+        switch ( opt ) {
+            case 'd': duration  = atoi(optarg); break;
+            case 'p': period    = atoi(optarg); break;
+            case 'r': poll_freq = atoi(optarg); break;
+            case 'q': qos       = atoi(optarg); break;
+            case 'x': client    = optarg;       break;
+            case 't': tolerance = atoi(optarg); break;
+            case 's': ack_delay = atoi(optarg); break;
+            case 'e': edge      = true;         break;
+            case 'a': async     = true;         break;
+            case 'R': reactor   = true;         break;
+            case 'H': reload    = true;         break;
+            case 'B': bank      = true;         break;
+            default:
+                fprintf(stderr, "Usage: %s [-d secs] [-p toggle msecs] [-r poll msecs] [-q qos] "
+                        "[-x rpisensorclient] [-t tolerance msecs] [-s ack delay msecs] [-e] [-a] [-R] [-H] [-B] "
+                        "[sensors ...]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    while ( optind < argc && num_counts < 32 ) {
+        counts[num_counts++] = atoi(argv[optind++]);
+    }
+    if ( num_counts == 0 ) {
+        num_counts = 5;
+    }
+    if ( !client ) {
+        // rpisensorclient is built next to us
+        char *slash = strrchr(argv[0], '/');
+        if ( asprintf(&client, "%.*srpisensorclient", slash ? (int)(slash-argv[0]+1) : 0, argv[0]) == -1 ) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if ( listener == -1 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+         listen(listener, 1) == -1 || getsockname(listener, (struct sockaddr*)&addr, &addr_length) == -1 ) {
+        fprintf(stderr, "Error: could not open MQTT listener [%s]\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    port = ntohs(addr.sin_port);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Pins toggle every %u msecs, sensors %s, QoS %d, %s publishing%s, %u secs per run\n",
+           period, edge ? "edge triggered" : "polled", qos, async ? "asynchronous" : "synchronous",
+           reactor ? " from the reactor" : "", duration);
+    if ( !edge ) {
+        printf("Sensors are read every %u msecs%s\n", poll_freq, bank ? ", all lines at once" : "");
+    }
+    if ( ack_delay ) {
+        printf("Broker acknowledges %u msecs late\n", ack_delay);
+    }
+    printf("%7s %5s %9s %9s %9s %9s %9s %9s %9s %9s %9s %8s %7s\n", "sensors", "tol", "msgs/s",
+           "p50 ms", "p90 ms", "p99 ms", "max ms", "jit avg", "jit max", "late avg", "wake/s", "reads/wk",
+           "cpu %");
+
+    for ( int i=0; i<num_counts; i++ ) {
+        if ( !runBench(listener, port, counts[i], 0, &exact) ||
+             (tolerance && !runBench(listener, port, counts[i], tolerance, &merged)) ) {
+            exit(EXIT_FAILURE);
+        }
+        if ( tolerance && merged < exact ) {
+            printf("        Error: %.2f reads per wakeup with tolerance, %.2f without\n", merged, exact);
+            result = EXIT_FAILURE;
+        }
+    }
+    close(listener);
+    return result;
+}
@@ -18,11 +18,13 @@
  * along with RPISensorClient.  If not, see <http://www.gnu.org/licenses/>.
  * ---------------------------------------------------------------------------------------
  */
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
 #include <linux/if.h>
 #include <netdb.h>
 #include <stdio.h>
@@ -32,12 +34,24 @@
 #include <unistd.h>
 #include <syslog.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <wiringPi.h>
 
 #include "MQTT.h"
 #include "DHT11.h"
+#include "GPIO.h"
+#include "Scheduler.h"
+#include "Sensors.h"
+#include "Payload.h"
+#include "Spool.h"
+#include "Journal.h"
+#include "Stats.h"
+#include "Reactor.h"
+#include "Log.h"
+#include "Shared.h"
 
 /*
  * ---------------------------------------------------------------------------------------
@@ -47,185 +61,1889 @@
 #define MQTT_BROKER_IP    "192.168.100.26"
 #define MQTT_BROKER_PORT  1883
 #define MQTT_KEEPALIVE    60
+#define MQTT_QOS          0
+#define MQTT_INFLIGHT     20
+#define MQTT_ASYNC        false
+#define REACTOR           false
 #define PID_FILE          "/var/run/RPISensorClient.pid"
 #define REPORT_CYCLE      30000
 #define MQTT_INTERFACE    "eth0"
 #define DEBUG             0
 #define PREFIX            "BB"
 #define CONFIG_FILE       "/etc/rpisensorclient.cfg"
+#define GPIO_CHIP         "/dev/gpiochip0"
+#define GPIO_BANK         false
+#define DHT11_PRIORITY    50
+#define DHT11_FRESHNESS   1000
+#define BATCH_TOPIC       "SENSORS"
+#define BATCH_WINDOW      0
+#define SPOOL_SIZE        16384
+#define SPOOL_RATE        10
+#define SPOOL_TOPIC       "RESENT"
+#define SPOOL_WINDOW      32                    /* resent, waiting to be confirmed     */
+#define SPOOL_CONFIRM     60000000              /* usec until resent once more         */
+#define JOURNAL_SIZE      16384
+#define JOURNAL_SEGMENT   1024
+#define STATS_SOCKET      "/var/run/RPISensorClient.stats"
+#define STATS_TOPIC       "STATS"
+#define STATS_INTERVAL    0
+#define LOG_RATE          20
 
 /*
  * ---------------------------------------------------------------------------------------
- * Maximum number of sensors to be monitored
+ * Value a sensor would never report
+ * ---------------------------------------------------------------------------------------
+ */
+#define RESET_VALUE   100
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Some globals we can't do without... ;)
+ * ---------------------------------------------------------------------------------------
+ */
+int      pidFilehandle    = 0;
+bool     deamon           = true;
+int8_t   debug            = DEBUG;
+char     *prefix          = PREFIX;
+char     *pidfile         = PID_FILE;
+char     *configFile      = CONFIG_FILE;
+char     *mqtt_broker_ip  = MQTT_BROKER_IP;
+int      mqtt_broker_port = MQTT_BROKER_PORT;
+int      mqtt_keepalive   = MQTT_KEEPALIVE;
+int      mqtt_qos         = MQTT_QOS;
+int      mqtt_inflight    = MQTT_INFLIGHT;
+bool     mqtt_async       = MQTT_ASYNC;
+char*    mqtt_interface   = MQTT_INTERFACE;
+bool     reactor          = REACTOR;          /* single threaded epoll event loop      */
+uint64_t report_cycle     = REPORT_CYCLE;
+gpio_backend_t gpio_type  = GPIO_WIRINGPI;
+char     *gpio_chip       = GPIO_CHIP;
+char     *gpio_sim_fifo   = NULL;
+bool     gpio_bank_mode   = GPIO_BANK;        /* read polled digital lines at once     */
+uint32_t debounce_stable[SENSOR_PINS];        /* msecs, per pin, see DEBOUNCE          */
+uint16_t debounce_flips[SENSOR_PINS];         /* changes per second, 0 = no limit      */
+uint32_t tolerance[SENSOR_PINS];              /* msecs, per pin, see TOLERANCE         */
+uint32_t timer_slack      = 0;                /* usec, smallest tolerance of any read  */
+uint32_t log_rate         = LOG_RATE;          /* syslog lines per second, 0 = all      */
+int      dht11_priority   = DHT11_PRIORITY;
+uint32_t dht11_freshness  = DHT11_FRESHNESS;
+uint32_t dht11_interval   = DHT11_INTERVAL;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * How changes are sent to the broker
+ *   PUBLISH_SENSOR  one message per change on the sensor's own topic (default)
+ *   PUBLISH_BATCH   all changes of one scheduler pass (or batch_window msecs) in a
+ *                   single message on <batch_topic>/<prefix>-<id>
+ *   PUBLISH_BOTH    both of the above
+ * ---------------------------------------------------------------------------------------
+ */
+typedef enum { PUBLISH_SENSOR, PUBLISH_BATCH, PUBLISH_BOTH } publishMode_t;
+
+publishMode_t publish_mode = PUBLISH_SENSOR;
+char     *batch_topic     = BATCH_TOPIC;
+uint64_t batch_window     = BATCH_WINDOW;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * What a message looks like
+ *   FORMAT_JSON     {"<label>":"<value>"}, batches {"<label>":"<value>",...}
+ *   FORMAT_CBOR     binary, index, value, time and quality flags, see Payload.h
+ * ---------------------------------------------------------------------------------------
+ */
+typedef enum { FORMAT_JSON, FORMAT_CBOR } payloadFormat_t;
+
+payloadFormat_t payload_format = FORMAT_JSON;
+bool     full_report      = false;            /* values are published for a full report */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * How the broker learns about values that did not change
+ *   REPORT_RESEND   the last value of every sensor is published again once per report
+ *                   cycle, sensor n of count at n/count of the cycle (default)
+ *   REPORT_RETAIN   sensor messages are retained by the broker, the values are only
+ *                   published again after the connection to the broker was lost
+ * Either way sensors are read on their own schedule only, the report cycle just looks
+ * at edge triggered ones in case an event got lost.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef enum { REPORT_RESEND, REPORT_RETAIN } reportMode_t;
+
+typedef struct {
+    uint64_t      start;                        /* usec, of the current cycle          */
+    uint32_t      next;                         /* next sensor in the cycle            */
+    bool          resend;                       /* cycle publishes the cached values   */
+    uint32_t      connects;                     /* mqtt_connects() at the last look    */
+    uint64_t      resent;                       /* values published from the cache     */
+    uint64_t      rereads;                      /* edge triggered sensors read again   */
+} reportCycle_t;
+
+reportMode_t  report_mode = REPORT_RESEND;
+reportCycle_t report;
+
+typedef struct {
+    uint64_t      changes;                      /* sensor values that changed          */
+    uint64_t      messages;                     /* MQTT messages actually published    */
+    uint64_t      bytes;                        /* ... and their size on the wire      */
+    uint64_t      sensor_bytes;                 /* wire size with one message/change   */
+} publishStats_t;
+
+publishStats_t publish_stats;
+
+typedef struct {
+    uint64_t      samples;                      /* scheduled reads of polled sensors   */
+    uint64_t      jitter_sum;                   /* |interval - freq|, usec             */
+    uint64_t      jitter_max;
+    uint64_t      late_sum;                     /* read time - due time, usec          */
+    uint64_t      late_max;
+    uint64_t      skipped;                      /* due times missed altogether         */
+    uint64_t      wakeups;                      /* passes of the main loop             */
+} sampleStats_t;
+
+sampleStats_t sample_stats;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * In bank mode all polled DIGITAL sensors are sampled together by a single read of
+ * their lines, at the frequency of the fastest one. The bank has its own entry on the
+ * schedule, only lines whose level changed since the last read are looked at.
+ * ---------------------------------------------------------------------------------------
+ */
+#define BANK_ENTRY    SENSOR_NONE               /* schedule index of the bank          */
+
+typedef struct {
+    uint8_t       pins[GPIO_BANK_MAX];          /* bit n of a bank read is pins[n]     */
+    int           lines;
+    uint64_t      invert;                       /* lines read inverted                 */
+    uint64_t      last;                         /* values of the last read             */
+    uint64_t      pending;                      /* lines with a debounce pending       */
+    bool          valid;                        /* false: report every line            */
+    uint32_t      freq;                         /* msecs, fastest sensor in the bank   */
+    uint32_t      tolerance;                    /* usec, smallest one in the bank      */
+    uint64_t      next_read;                    /* usec, CLOCK_MONOTONIC               */
+    uint64_t      last_sample;
+    uint64_t      reads;
+    uint64_t      changes;                      /* lines that changed                  */
+    uint32_t      read_max;                     /* usec, longest bank read             */
+    uint32_t      late_max;
+} digitalBank_t;
+
+digitalBank_t bank;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * SIGHUP reloads the configuration, the signal only raises reload_pending and the main
+ * loop applies the new sensor table between two passes. SIGINT and SIGTERM raise
+ * exit_pending, the main loop shuts down after the pass. Only the main thread takes them.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint32_t      reloads;                      /* new configurations applied          */
+    uint32_t      failed;                       /* reloads that kept the old table     */
+    uint64_t      latency_last;                 /* usec SIGHUP -> new table in use     */
+    uint64_t      latency_max;
+    uint64_t      silence_last;                 /* usec no sampling/publishing, reload */
+    uint64_t      silence_max;
+} reloadStats_t;
+
+reloadStats_t reload_stats;
+volatile sig_atomic_t reload_pending = 0;
+volatile sig_atomic_t exit_pending   = 0;
+uint64_t      reload_requested = 0;             /* usec, CLOCK_MONOTONIC               */
+bool          reloading        = false;         /* readConfig() for a running daemon   */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Live statistics: a JSON report for every client connecting to stats_socket, and every
+ * stats_interval msecs (if not 0) on <stats_topic>/<prefix>-<id>
+ * ---------------------------------------------------------------------------------------
+ */
+char     *stats_socket    = STATS_SOCKET;
+char     *stats_topic     = STATS_TOPIC;
+uint64_t stats_interval   = STATS_INTERVAL;
+char     *stats_full_topic = NULL;
+uint64_t start_time       = 0;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Readings that could not be published are kept in the spool file (if configured) and
+ * sent again at no more than spool_rate messages per second once the broker is back, on
+ * <spool_topic>/<prefix>-<id> so they don't pass for the latest values
+ * ---------------------------------------------------------------------------------------
+ */
+char     *spool_file      = NULL;
+uint32_t spool_size       = SPOOL_SIZE;
+uint32_t spool_rate       = SPOOL_RATE;
+bool     spool_drop_oldest = true;
+char     *spool_topic     = SPOOL_TOPIC;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Every published reading also goes to the local journal in journal_dir (if configured),
+ * journal_segment KiB per segment file and journal_size KiB for all of them
+ * ---------------------------------------------------------------------------------------
+ */
+char     *journal_dir     = NULL;
+uint32_t journal_size     = JOURNAL_SIZE;
+uint32_t journal_segment  = JOURNAL_SEGMENT;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Last value, time and quality of every sensor in the POSIX shared memory segment
+ * shared_memory (if configured), for local readers, see Shared.h
+ * ---------------------------------------------------------------------------------------
+ */
+char     *shared_memory   = NULL;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * sensor specific data, see Sensors.h
+ * ---------------------------------------------------------------------------------------
+ */
+sensor_table_t sensors;                         /* grows as SENSOR lines are read      */
+scheduler_t schedule;                           /* polled sensors ordered by next_read */
+
+uint32_t    *batch_list  = NULL;                /* sensors changed since last flush    */
+size_t      batch_count  = 0;
+uint64_t    batch_start  = 0;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Message buffers, sized for the longest possible message once the topics are known
+ * ---------------------------------------------------------------------------------------
+ */
+char        *msg_buffer   = NULL;
+char        *batch_buffer = NULL;
+char        *batch_full_topic = NULL;
+char        *spool_full_topic = NULL;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Function prototypes
+ * ---------------------------------------------------------------------------------------
+ */
+void prepareTopics(char* id);
+size_t renderValue(char* buffer, uint32_t index);
+size_t encodeValue(uint8_t* buffer, uint32_t index);
+void readSensor(char* id, uint32_t index);
+uint16_t filterValue(uint32_t index, uint16_t level, uint64_t now);
+void publishValue(char* id, uint32_t index);
+uint64_t reportSensors(char* id, uint64_t now);
+void publishSummary(char* id, uint32_t index, uint64_t now);
+void aggregateValue(char* id, uint32_t index, uint16_t value, uint64_t now);
+void flushBatch(char* id, bool force);
+uint64_t batchDeadline(void);
+uint64_t current_timestamp(void);
+uint64_t monotonic_timestamp(void);
+void spreadSensors(uint64_t start);
+bool watchSensor(sensor_t *sensor);
+void reloadConfig(char* id);
+void spoolValue(uint32_t index);
+uint64_t drainSpool(uint64_t now);
+uint32_t configSignature(void);
+bool configNumber( const char *text, long max, long *number );
+bool journalSensors(void);
+bool sharedSensors(void);
+void writeStats(FILE *fp, bool per_sensor);
+void serveStats(void);
+void publishStats(void);
+void pollSensor(char* id, uint32_t index, uint64_t now);
+void setupBank(void);
+void applyTolerance(void);
+void sampleBank(char* id, uint64_t now, bool force);
+void handleEvent(char* id, gpio_event_t *event);
+void handleResult(char* id, dht11_result_t *result);
+bool wakeOn(int fd);
+void waitReactor(char* id, uint64_t next_time);
+bool get_id ( char* id );
+void sigendCB(int sigval);
+void shutdown_daemon(void);
+void printSummary(FILE *fp);
+size_t readConfig(void);
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * there are many ways to die
+ * ---------------------------------------------------------------------------------------
+ */
+void sigendCB(int sigval)
+{
+    switch(sigval)
+    {
+        case SIGHUP:
+            reload_requested = monotonic_timestamp();
+            reload_pending   = 1;
+            break;
+        case SIGINT:
+        case SIGTERM:
+            exit_pending = 1;
+            break;
+        default:
+            log_msg(LOG_WARNING, "Unhandled signal %s", strsignal(sigval));
+            break;
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * shutdwown deamon
+ * ---------------------------------------------------------------------------------------
+ */
+void shutdown_daemon(void) {
+    if (!deamon) {
+        printSummary(stdout);
+    }
+    log_stop();
+    closelog();
+    dht11_reader_stop();
+    mqtt_end();
+    gpio_end();
+    spool_close();
+    journal_close();
+    shared_close();
+    stats_close();
+    reactor_end();
+    if (deamon) {
+        close(pidFilehandle);
+        unlink(pidfile);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * One line summary for runs in the foreground, rpisensorbench relies on the format
+ * ---------------------------------------------------------------------------------------
+ */
+void printSummary(FILE *fp) {
+    fprintf(fp, "Sampled %llu times, jitter avg %llu max %llu usec, late avg %llu max %llu usec, "
+            "%llu skipped, %llu changes in %llu messages, %u reloads, latency max %llu usec, "
+            "silence max %llu usec, %llu wakeups\n",
+            (unsigned long long)sample_stats.samples,
+            (unsigned long long)(sample_stats.samples ? sample_stats.jitter_sum / sample_stats.samples : 0),
+            (unsigned long long)sample_stats.jitter_max,
+            (unsigned long long)(sample_stats.samples ? sample_stats.late_sum / sample_stats.samples : 0),
+            (unsigned long long)sample_stats.late_max,
+            (unsigned long long)sample_stats.skipped,
+            (unsigned long long)publish_stats.changes,
+            (unsigned long long)publish_stats.messages,
+            reload_stats.reloads,
+            (unsigned long long)reload_stats.latency_max,
+            (unsigned long long)reload_stats.silence_max,
+            (unsigned long long)sample_stats.wakeups);
+    fflush(fp);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * get the last two bytes of the MAC address of the MQTT_INTERFACE
+ * ---------------------------------------------------------------------------------------
+ */
+bool get_id ( char* id ) {
+    bool success = false;
+    struct ifreq s;
+    int fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+    
+    strcpy(s.ifr_name, mqtt_interface );
+    if (0 == ioctl(fd, SIOCGIFHWADDR, &s)) {
+        sprintf(id, "%02x%02x",s.ifr_addr.sa_data[4], s.ifr_addr.sa_data[5]);
+        success = true;
+    } else {
+        success = false;
+    }
+    return success;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * The binary counterpart of renderValue(), time is when the value was published
+ * ---------------------------------------------------------------------------------------
+ */
+size_t encodeValue(uint8_t* buffer, uint32_t index) {
+    payload_reading_t reading = {
+        .index = index,
+        .value = sensors.value[index],
+        .flags = sensors.meta[index].quality,
+        .time  = sensors.meta[index].changed / 1000
+    };
+    return payload_cbor(buffer, &reading);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Read sensor and publish value to MQTT broker. DHT11 sensors are only queued for the
+ * reader thread here, their values are published by handleResult(), right away when
+ * the pin was read recently enough.
+ * ---------------------------------------------------------------------------------------
+ */
+void readSensor(char* id, uint32_t index) {
+    sensor_t *sensor   = &sensors.meta[index];
+    uint16_t new_value = sensors.value[index];
+    
+    switch( sensor->type ) {
+        case DIGITAL: {
+            uint64_t start = stats_timestamp();
+            new_value = gpio_read(sensor->pin);
+            uint64_t duration = stats_timestamp() - start;
+
+            stats_record(STATS_READ_DIGITAL, duration);
+            sensor->reads++;
+            if ( duration > sensor->read_max ) {
+                sensor->read_max = duration;
+            }
+            if ( sensor->invert ) {
+                if ( new_value != 0 ) {
+                    new_value = 0;
+                } else {
+                    new_value = 1;
+                }
+            }
+            new_value = filterValue(index, new_value, monotonic_timestamp());
+            if ( aggregate_active(&sensor->aggregate) ) {
+                aggregateValue(id, index, new_value, monotonic_timestamp());
+                return;
+            }
+            break;
+        }
+        case DHT11_TMP:
+        case DHT11_HMD: {
+            dht11_result_t cached;
+
+            switch ( dht11_request(sensor->pin, &cached) ) {
+                case DHT11_CACHED:
+                    handleResult(id, &cached);
+                    return;
+                case DHT11_FULL:
+                    log_msg(LOG_ERR, "Error: DHT11 queue full, skipping read of '%s'", sensor->label);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+            
+        default:
+            log_msg(LOG_ERR, "Unknown sensor type");
+            break;
+    }
+    
+    if ( sensors.value[index] != new_value ) {
+        sensors.value[index] = new_value;
+        publishValue(id, index);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Readings of an aggregated sensor only go into its window, the summary is published
+ * with the first reading after the window is over. Changes still go to the journal and
+ * the shared memory values.
+ * ---------------------------------------------------------------------------------------
+ */
+void aggregateValue(char* id, uint32_t index, uint16_t value, uint64_t now) {
+    sensor_t *sensor = &sensors.meta[index];
+
+    aggregate_feed(&sensor->aggregate, value, now);
+    if ( sensors.value[index] != value ) {
+        sensors.value[index] = value;
+        if ( journal_dir ) {
+            journal_append(index, current_timestamp(), value);
+        }
+        if ( shared_memory ) {
+            shared_update(index, value, 0, current_timestamp());
+        }
+    }
+    if ( aggregate_due(&sensor->aggregate, now) ) {
+        publishSummary(id, index, now);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Pass a digital level through the sensor's debounce filter (if it has one). Polled
+ * sensors feed a pending change again with their next read, edge triggered ones get an
+ * entry on the schedule for the time it may be taken over.
+ * ---------------------------------------------------------------------------------------
+ */
+uint16_t filterValue(uint32_t index, uint16_t level, uint64_t now) {
+    sensor_t *sensor = &sensors.meta[index];
+    uint64_t recheck;
+
+    if ( !debounce_active(&sensor->debounce) ) {
+        return level;
+    }
+    level = debounce_feed(&sensor->debounce, level, now, &recheck);
+    if ( recheck && sensors.poll[index].edge && !sensor->recheck ) {
+        sensor->recheck = recheck;
+        sched_push(&schedule, recheck, index);
+    }
+    return level;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Render the constant parts of every message once, so publishing only has to fill in
+ * the value. Sensors that already have their topic keep it, so this can run again after
+ * a reload to cover the new sensors and resize the buffers.
+ * ---------------------------------------------------------------------------------------
+ */
+void prepareTopics(char* id) {
+    size_t msg_size = 0, batch_size = 2;
+    char   *msg, *batch;
+
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        sensor_t *sensor = &sensors.meta[index];
+
+        if ( !sensor->topic ) {
+            sensor->topic_length = asprintf(&sensor->topic, "%s/%s-%s/%d", sensor->label, prefix, id, sensor->pin);
+            sensor->json_length  = asprintf(&sensor->json, "{\"%s\":\"", sensor->label);
+            if ( sensor->topic_length == (size_t)-1 || sensor->json_length == (size_t)-1 ) {
+                log_msg(LOG_ERR, "Out of memory preparing topic for '%s'", sensor->label);
+                exit(EXIT_FAILURE);
+            }
+        }
+        // {"<label>":"65535","time":<20 digits>} and ,"<label>":"65535"
+        if ( sensor->json_length + 40 > msg_size ) {
+            msg_size = sensor->json_length + 40;
+        }
+        // ,"min":65535,"max":65535,"mean":65535.000,"count":<10>,"high":<20>} on top
+        if ( aggregate_active(&sensor->aggregate) && sensor->json_length + 120 > msg_size ) {
+            msg_size = sensor->json_length + 120;
+        }
+        batch_size += sensor->json_length + 7;
+    }
+    if ( msg_size < PAYLOAD_SUMMARY_MAX ) {
+        msg_size = PAYLOAD_SUMMARY_MAX;
+    }
+    if ( batch_size < PAYLOAD_BATCH_MAX + sensors.count * PAYLOAD_ENTRY_MAX ) {
+        batch_size = PAYLOAD_BATCH_MAX + sensors.count * PAYLOAD_ENTRY_MAX;
+    }
+
+    msg   = realloc(msg_buffer, msg_size);
+    batch = realloc(batch_buffer, batch_size);
+    if ( msg ) {
+        msg_buffer = msg;
+    }
+    if ( batch ) {
+        batch_buffer = batch;
+    }
+    if ( !msg || !batch ||
+         (!batch_full_topic && asprintf(&batch_full_topic, "%s/%s-%s", batch_topic, prefix, id) == -1) ||
+         (!stats_full_topic && asprintf(&stats_full_topic, "%s/%s-%s", stats_topic, prefix, id) == -1) ||
+         (!spool_full_topic && asprintf(&spool_full_topic, "%s/%s-%s", spool_topic, prefix, id) == -1) ) {
+        log_msg(LOG_ERR, "Out of memory preparing message buffers");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * {"<label>":"<value>"} from the prepared template, returns the message length
+ * ---------------------------------------------------------------------------------------
+ */
+size_t renderValue(char* buffer, uint32_t index) {
+    sensor_t *sensor = &sensors.meta[index];
+
+    return payload_json(buffer, sensor->json, sensor->json_length, sensors.value[index]);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Publish a sensor value to MQTT broker, and/or add it to the current batch
+ * ---------------------------------------------------------------------------------------
+ */
+void publishValue(char* id, uint32_t index) {
+    sensor_t *sensor = &sensors.meta[index];
+    size_t   length;
+
+    sensor->changed = monotonic_timestamp();
+    sensor->quality = (full_report ? PAYLOAD_FULL_REPORT : 0) |
+                      (debounce_active(&sensor->debounce) ? PAYLOAD_DEBOUNCED : 0);
+    if ( payload_format == FORMAT_CBOR ) {
+        length = encodeValue((uint8_t*)msg_buffer, index);
+    } else {
+        length = renderValue(msg_buffer, index);
+    }
+
+    if ( debug ) {
+        log_msg(LOG_INFO, "%s: %d", sensor->label, sensors.value[index]);
+    }
+    if ( journal_dir && !full_report ) {
+        journal_append(index, current_timestamp(), sensors.value[index]);
+    }
+    if ( shared_memory ) {
+        shared_update(index, sensors.value[index], sensor->quality, current_timestamp());
+    }
+
+    publish_stats.changes++;
+    publish_stats.sensor_bytes += mqtt_packet_size(sensor->topic_length, length);
+
+    if ( publish_mode != PUBLISH_SENSOR && !sensors.batched[index] ) {
+        if ( batch_count == 0 ) {
+            batch_start = monotonic_timestamp();
+        }
+        sensors.batched[index] = true;
+        batch_list[batch_count++] = index;
+    }
+    if ( publish_mode != PUBLISH_BATCH ) {
+        publish_stats.messages++;
+        publish_stats.bytes += mqtt_packet_size(sensor->topic_length, length);
+        if ( ! mqtt_publish_message( sensor->topic, msg_buffer, length, report_mode == REPORT_RETAIN ) ) {
+            log_msg(LOG_ERR, "Error: Did not publish message: %s\n",
+                    (payload_format == FORMAT_JSON) ? msg_buffer : sensor->label);
+            spoolValue(index);
+        }
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Publish the summary of an aggregated sensor's window and start the next one. Always
+ * on the sensor topic, whatever the publish mode, JSON adds the summary to the message
+ * of the last value:
+ *   {"<label>":"<last>","min":<min>,"max":<max>,"mean":<mean>,"count":<n>,"high":<msecs>}
+ * high only for DIGITAL sensors.
+ * ---------------------------------------------------------------------------------------
+ */
+void publishSummary(char* id, uint32_t index, uint64_t now) {
+    sensor_t            *sensor = &sensors.meta[index];
+    aggregate_summary_t summary;
+    size_t              length;
+
+    aggregate_close(&sensor->aggregate, now, &summary);
+    if ( summary.count == 0 ) {
+        return;
+    }
+    sensor->changed = now;
+    sensor->quality = PAYLOAD_SUMMARY |
+                      (debounce_active(&sensor->debounce) ? PAYLOAD_DEBOUNCED : 0);
+
+    if ( payload_format == FORMAT_CBOR ) {
+        payload_reading_t reading = {
+            .index = index,
+            .value = summary.last,
+            .flags = sensor->quality,
+            .time  = now / 1000
+        };
+        length = payload_cbor_summary((uint8_t*)msg_buffer, &reading, &summary);
+    } else {
+        length  = renderValue(msg_buffer, index) - 1;
+        length += sprintf(msg_buffer+length, ",\"min\":%u,\"max\":%u,\"mean\":%u.%03u,\"count\":%u",
+                          summary.min, summary.max, summary.mean / 1000, summary.mean % 1000, summary.count);
+        if ( sensor->type == DIGITAL ) {
+            length += sprintf(msg_buffer+length, ",\"high\":%llu", (unsigned long long)summary.high);
+        }
+        length += sprintf(msg_buffer+length, "}");
+    }
+
+    if ( debug ) {
+        log_msg(LOG_INFO, "%s: %u readings in %llu msecs, min %u max %u last %u",
+                sensor->label, summary.count, (unsigned long long)summary.span,
+                summary.min, summary.max, summary.last);
+    }
+
+    publish_stats.changes++;
+    publish_stats.messages++;
+    publish_stats.sensor_bytes += mqtt_packet_size(sensor->topic_length, length);
+    publish_stats.bytes        += mqtt_packet_size(sensor->topic_length, length);
+    if ( ! mqtt_publish_message( sensor->topic, msg_buffer, length, report_mode == REPORT_RETAIN ) ) {
+        log_msg(LOG_ERR, "Error: Did not publish summary of '%s'", sensor->label);
+        spoolValue(index);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Send all batched changes as one {"<label>":"<value>",...} message (or CBOR batch),
+ * unless the coalescing window is still open
+ * ---------------------------------------------------------------------------------------
+ */
+void flushBatch(char* id, bool force) {
+    size_t length = 0;
+
+    if ( batch_count == 0 || (!force && monotonic_timestamp() < batchDeadline()) ) {
+        return;
+    }
+
+    if ( payload_format == FORMAT_CBOR ) {
+        // a sensor changing again keeps its place, so the earliest time can be anywhere
+        uint8_t  *buffer = (uint8_t*)batch_buffer;
+        uint64_t time    = (uint64_t)-1;
+
+        for ( size_t i=0; i<batch_count; i++ ) {
+            if ( sensors.meta[batch_list[i]].changed < time ) {
+                time = sensors.meta[batch_list[i]].changed;
+            }
+        }
+        length = payload_cbor_batch(buffer, batch_count, time / 1000);
+        for ( size_t i=0; i<batch_count; i++ ) {
+            payload_reading_t reading = {
+                .index = batch_list[i],
+                .value = sensors.value[batch_list[i]],
+                .flags = sensors.meta[batch_list[i]].quality,
+                .time  = sensors.meta[batch_list[i]].changed / 1000
+            };
+            length += payload_cbor_entry(buffer+length, &reading, time / 1000);
+            sensors.batched[batch_list[i]] = false;
+        }
+    } else {
+        // each entry is the single sensor message with '{' replaced and '}' dropped
+        for ( size_t i=0; i<batch_count; i++ ) {
+            size_t start = length;
+
+            length += renderValue(batch_buffer+length, batch_list[i]) - 1;
+            batch_buffer[start] = i ? ',' : '{';
+            sensors.batched[batch_list[i]] = false;
+        }
+        batch_buffer[length++] = '}';
+        batch_buffer[length]   = '\0';
+    }
+
+    publish_stats.messages++;
+    publish_stats.bytes += mqtt_packet_size(strlen(batch_full_topic), length);
+    if ( ! mqtt_publish_data( batch_full_topic, batch_buffer, length ) ) {
+        log_msg(LOG_ERR, "Error: Did not publish batch of %zu changes", batch_count);
+        if ( publish_mode == PUBLISH_BATCH ) {
+            for ( size_t i=0; i<batch_count; i++ ) {
+                spoolValue(batch_list[i]);
+            }
+        }
+    }
+    batch_count = 0;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Keep a reading that did not make it to the broker, with the time it was taken
+ * ---------------------------------------------------------------------------------------
+ */
+void spoolValue(uint32_t index) {
+    spool_record_t record;
+
+    if ( !spool_file ) {
+        return;
+    }
+    record.timestamp = current_timestamp() - (monotonic_timestamp() - sensors.meta[index].changed) / 1000;
+    record.index     = index;
+    record.value     = sensors.value[index];
+    record.flags     = sensors.meta[index].quality;
+    if ( !spool_put(&record) && debug ) {
+        log_msg(LOG_INFO, "Spool full, dropped reading of '%s'", sensors.meta[index].label);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Resend spooled readings as {"<label>":"<value>","time":<msecs since epoch>} (or CBOR
+ * flagged PAYLOAD_RESENT) on the resend topic, rate limited. A reading stays in the
+ * spool until the broker confirmed it, at most SPOOL_WINDOW of them are on the way. If
+ * one failed or is not confirmed within SPOOL_CONFIRM, all of them are sent again.
+ * Returns when to come back for more.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    spool_record_t  record;
+    uint32_t        ticket;                     /* 0: sensor gone, nothing sent        */
+    uint64_t        sent;                       /* usec, CLOCK_MONOTONIC               */
+} resend_t;
+
+uint64_t drainSpool(uint64_t now) {
+    static uint64_t last_drain = 0;
+    static resend_t resend[SPOOL_WINDOW];
+    static size_t   resend_count = 0;
+    spool_record_t  record;
+    uint64_t        budget;
+
+    // take what the broker has off the spool, oldest first; a reading no longer at the
+    // head was dropped from a full spool or remapped by a reload
+    while ( resend_count ) {
+        mqtt_delivery_t delivery = resend[0].ticket ? mqtt_delivery(resend[0].ticket) : MQTT_DELIVERED;
+        bool            head     = spool_peek(&record) && !memcmp(&record, &resend[0].record, sizeof(record));
+
+        if ( head && delivery == MQTT_PENDING && now - resend[0].sent < SPOOL_CONFIRM ) {
+            break;
+        }
+        if ( head && delivery != MQTT_DELIVERED ) {
+            resend_count = 0;
+            break;
+        }
+        if ( head ) {
+            spool_pop();
+        }
+        memmove(resend, resend+1, --resend_count * sizeof(resend_t));
+    }
+
+    if ( spool_count() == 0 || !mqtt_connected() || spool_rate == 0 ) {
+        last_drain = now;
+        return (uint64_t)-1;
+    }
+
+    budget = (now - last_drain) * spool_rate / 1000000;
+    if ( resend_count == SPOOL_WINDOW ) {
+        last_drain = now;
+    }
+    while ( budget && resend_count < SPOOL_WINDOW && spool_peek_at(resend_count, &record) ) {
+        uint32_t ticket = 0;
+
+        if ( record.index < sensors.count ) {
+            sensor_t *sensor = &sensors.meta[record.index];
+            size_t   length;
+
+            if ( payload_format == FORMAT_CBOR ) {
+                payload_reading_t reading = {
+                    .index = record.index,
+                    .value = record.value,
+                    .flags = record.flags | PAYLOAD_RESENT,
+                    .time  = record.timestamp
+                };
+                length = payload_cbor((uint8_t*)msg_buffer, &reading);
+            } else {
+                memcpy(msg_buffer, sensor->json, sensor->json_length);
+                length = sensor->json_length +
+                         sprintf(msg_buffer+sensor->json_length, "%u\",\"time\":%llu}",
+                                 record.value, (unsigned long long)record.timestamp);
+            }
+            if ( !mqtt_publish_tracked( spool_full_topic, msg_buffer, length, &ticket ) ) {
+                break;                              /* broker gone again, retry later  */
+            }
+        }
+        resend[resend_count].record = record;
+        resend[resend_count].ticket = ticket;
+        resend[resend_count].sent   = now;
+        resend_count++;
+        last_drain = now;
+        budget--;
+    }
+    return spool_count() ? now + 1000000 / spool_rate + 1 : (uint64_t)-1;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Tell the journal which label each sensor index stands for, starts a new segment
  * ---------------------------------------------------------------------------------------
  */
-#define MAX_SENSORS    32
+bool journalSensors(void) {
+    const char **labels = malloc((sensors.count ? sensors.count : 1) * sizeof(char*));
+    bool       ok;
+
+    if ( !labels ) {
+        return false;
+    }
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        labels[index] = sensors.meta[index].label;
+    }
+    ok = journal_sensors(labels, sensors.count);
+    free(labels);
+    return ok;
+}
 
 /*
  * ---------------------------------------------------------------------------------------
- * Value a sensor would never report
+ * Sensor table for the shared memory values, with what each sensor published last
  * ---------------------------------------------------------------------------------------
  */
-#define RESET_VALUE   100
+bool sharedSensors(void) {
+    shared_value_t *values = calloc(sensors.count ? sensors.count : 1, sizeof(shared_value_t));
+    uint64_t       now     = monotonic_timestamp();
+    uint64_t       epoch   = current_timestamp();
+    bool           ok;
+
+    if ( !values ) {
+        return false;
+    }
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        sensor_t *sensor = &sensors.meta[index];
+
+        strncpy(values[index].label, sensor->label, SHARED_LABEL-1);
+        values[index].pin     = sensor->pin;
+        values[index].quality = sensor->quality;
+        values[index].value   = sensors.value[index];
+        if ( sensor->changed ) {
+            values[index].time = epoch - (now - sensor->changed) / 1000;
+        }
+    }
+    ok = shared_sensors(values, sensors.count);
+    free(values);
+    return ok;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Hash over the sensor table, spooled sensor indices are only valid for the same table
+ * ---------------------------------------------------------------------------------------
+ */
+uint32_t configSignature(void) {
+    uint32_t hash = 2166136261u;                    /* FNV-1a                          */
+
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        for ( char *c=sensors.meta[index].topic; *c; c++ ) {
+            hash = (hash ^ (uint8_t)*c) * 16777619u;
+        }
+        hash = (hash ^ sensors.meta[index].type) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Statistics as one JSON object, optionally with a line per sensor to spot slow ones
+ * ---------------------------------------------------------------------------------------
+ */
+void writeStats(FILE *fp, bool per_sensor) {
+    mqtt_stats_t  mqtt;
+    dht11_stats_t dht;
+    log_stats_t   log;
+    uint64_t      suppressed = 0, held = 0, uptime = monotonic_timestamp() - start_time;
+    uint64_t      adaptive = 0, adaptive_reads = 0, fixed_reads = 0;
+
+    mqtt_stats(&mqtt);
+    dht11_reader_stats(&dht);
+
+    fprintf(fp, "{\"uptime\":%llu,\"sensors\":%zu,",
+            (unsigned long long)uptime / 1000000, sensors.count);
+    fprintf(fp, "\"changes\":%llu,\"messages\":%llu,\"bytes\":%llu,",
+            (unsigned long long)publish_stats.changes,
+            (unsigned long long)publish_stats.messages,
+            (unsigned long long)publish_stats.bytes);
+    fprintf(fp, "\"mqtt\":{\"published\":%u,\"failed\":%u,\"retried\":%u,\"dropped\":%u,\"depth\":%u,"
+            "\"inflight\":%u},",
+            mqtt.published, mqtt.failed, mqtt.retried, mqtt.dropped, mqtt.depth, mqtt.inflight);
+    fprintf(fp, "\"dht11\":{\"reads\":%u,\"failures\":%u,\"cache_hits\":%u},",
+            dht.reads, dht.failures, dht.cache_hits);
+    if ( spool_file ) {
+        fprintf(fp, "\"spool\":{\"waiting\":%u,\"dropped\":%u},", spool_count(), spool_dropped());
+    }
+    log_stats(&log);
+    fprintf(fp, "\"log\":{\"queued\":%u,\"dropped\":%u,\"written\":%u,\"suppressed\":%u,"
+            "\"repeated\":%u,\"depth_max\":%u},",
+            log.queued, log.dropped, log.written, log.suppressed, log.repeated, log.depth_max);
+    fprintf(fp, "\"wakeups\":%llu,\"timer_slack\":%u,",
+            (unsigned long long)sample_stats.wakeups, timer_slack);
+    fprintf(fp, "\"report\":{\"resent\":%llu,\"rereads\":%llu},",
+            (unsigned long long)report.resent, (unsigned long long)report.rereads);
+    if ( journal_dir ) {
+        journal_stats_t journal;
+        journal_stats(&journal);
+        fprintf(fp, "\"journal\":{\"segments\":%u,\"blocks\":%u,\"readings\":%llu,\"bytes\":%llu},",
+                journal.segments, journal.blocks, (unsigned long long)journal.readings,
+                (unsigned long long)journal.bytes);
+    }
+    fprintf(fp, "\"reload\":{\"count\":%u,\"failed\":%u,\"latency\":%llu,\"latency_max\":%llu,"
+            "\"silence\":%llu,\"silence_max\":%llu},",
+            reload_stats.reloads, reload_stats.failed,
+            (unsigned long long)reload_stats.latency_last,
+            (unsigned long long)reload_stats.latency_max,
+            (unsigned long long)reload_stats.silence_last,
+            (unsigned long long)reload_stats.silence_max);
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        suppressed += sensors.meta[index].debounce.suppressed;
+        held       += sensors.meta[index].debounce.held;
+    }
+    fprintf(fp, "\"debounce\":{\"suppressed\":%llu,\"held\":%llu},",
+            (unsigned long long)suppressed, (unsigned long long)held);
+    // reads of adaptive sensors, and how many it would have been at their fixed frequency
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        sensor_poll_t *poll = &sensors.poll[index];
+
+        if ( poll->freq_max ) {
+            adaptive++;
+            adaptive_reads += sensors.meta[index].reads;
+            if ( poll->freq ) {
+                fixed_reads += uptime / ((uint64_t)poll->freq * 1000);
+            }
+        }
+    }
+    if ( adaptive ) {
+        fprintf(fp, "\"adaptive\":{\"sensors\":%llu,\"reads\":%llu,\"reads_fixed\":%llu},",
+                (unsigned long long)adaptive, (unsigned long long)adaptive_reads,
+                (unsigned long long)fixed_reads);
+    }
+    if ( bank.lines ) {
+        fprintf(fp, "\"bank\":{\"lines\":%d,\"reads\":%llu,\"changes\":%llu,\"read_max\":%u},",
+                bank.lines, (unsigned long long)bank.reads, (unsigned long long)bank.changes,
+                bank.read_max);
+    }
+    stats_print(fp);
+
+    if ( per_sensor ) {
+        fprintf(fp, ",\n\"sensor\":[");
+        for ( size_t index=0; index<sensors.count; index++ ) {
+            sensor_t *sensor = &sensors.meta[index];
+
+            // banked sensors are read and scheduled with the bank
+            fprintf(fp, "%s\n{\"label\":\"%s\",\"pin\":%d,\"value\":%u,\"reads\":%u,"
+                    "\"read_max\":%u,\"late_max\":%u",
+                    index ? "," : "", sensor->label, sensor->pin, sensors.value[index],
+                    sensor->banked ? (uint32_t)bank.reads : sensor->reads,
+                    sensor->banked ? bank.read_max : sensor->read_max,
+                    sensor->banked ? bank.late_max : sensor->late_max);
+            if ( sensor->type != DIGITAL ) {
+                fprintf(fp, ",\"failures\":%u", dht11_failures(sensor->pin));
+            }
+            if ( debounce_active(&sensor->debounce) ) {
+                fprintf(fp, ",\"suppressed\":%u,\"held\":%u",
+                        sensor->debounce.suppressed, sensor->debounce.held);
+            }
+            if ( !sensors.poll[index].edge && uptime ) {
+                fprintf(fp, ",\"rate\":%.2f", (sensor->banked ? bank.reads : sensor->reads) * 1e6 / uptime);
+            }
+            if ( sensors.poll[index].freq_max ) {
+                fprintf(fp, ",\"period\":%u", sensors.poll[index].period);
+            }
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "]");
+    }
+    fprintf(fp, "}\n");
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Full report with all sensors to everybody waiting on the stats socket
+ * ---------------------------------------------------------------------------------------
+ */
+void serveStats(void) {
+    int fd;
+
+    while ( (fd = stats_accept()) != -1 ) {
+        FILE *fp = fdopen(fd, "w");
+        if ( fp ) {
+            writeStats(fp, true);
+            fclose(fp);
+        } else {
+            close(fd);
+        }
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Summary without the sensor list on the stats topic
+ * ---------------------------------------------------------------------------------------
+ */
+void publishStats(void) {
+    char   *message = NULL;
+    size_t size;
+    FILE   *fp = open_memstream(&message, &size);
+
+    if ( !fp ) {
+        return;
+    }
+    writeStats(fp, false);
+    fclose(fp);
+    message[size-1] = '\0';                           /* no trailing newline          */
+    if ( !mqtt_publish(stats_full_topic, message) && debug ) {
+        log_msg(LOG_INFO, "Could not publish statistics");
+    }
+    free(message);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Time the current batch has to go out, (uint64_t)-1 if there is nothing to send
+ * ---------------------------------------------------------------------------------------
+ */
+uint64_t batchDeadline(void) {
+    if ( batch_count == 0 ) {
+        return (uint64_t)-1;
+    }
+    return batch_start + batch_window * 1000;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Go through the sensors of the report cycle that are due by now: edge triggered ones
+ * are read (only published if that finds a change), the cached value of the others is
+ * published again if the cycle resends. Aggregated sensors have their summaries and
+ * sensors never read so far nothing to send. Returns when the next one is due.
+ * ---------------------------------------------------------------------------------------
+ */
+uint64_t reportSensors(char* id, uint64_t now) {
+    uint64_t cycle = report_cycle * 1000;
+
+    while ( report.next < sensors.count ) {
+        uint32_t index   = report.next;
+        sensor_t *sensor = &sensors.meta[index];
+        uint64_t due     = report.start + cycle * index / sensors.count;
+        uint64_t changes = publish_stats.changes;
+
+        if ( due > now ) {
+            return due;
+        }
+        report.next++;
+
+        if ( sensors.poll[index].edge ) {
+            pollSensor(id, index, now);
+            report.rereads++;
+        }
+        if ( report.resend && publish_stats.changes == changes && sensors.value[index] != RESET_VALUE &&
+             !aggregate_active(&sensor->aggregate) ) {
+            full_report = true;
+            publishValue(id, index);
+            full_report = false;
+            report.resent++;
+        }
+    }
+    return (uint64_t)-1;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Read a sensor and put it back on the schedule, edge triggered sensors are only
+ * polled by the report cycle. Every sensor has a fixed grid of due times (its phase plus a
+ * multiple of its frequency), so being late once does not push back all later reads.
+ * Lateness is how far a scheduled read ran after its due time, jitter how far the
+ * interval between two scheduled reads is off from the configured frequency.
+ * ---------------------------------------------------------------------------------------
+ */
+static void recordSample(uint64_t last_sample, uint64_t next_read, uint64_t period,
+                         uint64_t sampled, uint32_t *late_max) {
+    uint64_t interval = sampled - last_sample;
+    uint64_t jitter   = (interval > period) ? interval - period : period - interval;
+    uint64_t late     = (sampled > next_read) ? sampled - next_read : 0;
+
+    stats_record(STATS_LATENESS, late);
+    if ( late > *late_max ) {
+        *late_max = late;
+    }
+    sample_stats.samples++;
+    sample_stats.jitter_sum += jitter;
+    sample_stats.late_sum   += late;
+    if ( jitter > sample_stats.jitter_max ) {
+        sample_stats.jitter_max = jitter;
+    }
+    if ( late > sample_stats.late_max ) {
+        sample_stats.late_max = late;
+    }
+}
+
+static void nextDue(uint64_t *next_read, uint64_t period, uint64_t now, bool due) {
+    // next due time on the grid, due times already passed are skipped
+    if ( period == 0 ) {
+        *next_read = now;
+    } else if ( due ) {
+        uint64_t missed = (now - *next_read) / period;
+        *next_read           += (missed + 1) * period;
+        sample_stats.skipped += missed;
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Adaptive polling: back to the configured frequency as soon as a read finds a new value
+ * (or a change waiting in the debounce filter), twice the interval for every read that
+ * does not, up to freq_max. DHT11 values come in after the read, they count with the
+ * next one.
+ * ---------------------------------------------------------------------------------------
+ */
+static void adaptPeriod(uint32_t index, uint16_t value) {
+    sensor_t      *sensor = &sensors.meta[index];
+    sensor_poll_t *poll   = &sensors.poll[index];
+    bool          active  = (value != sensor->polled) ||
+                            (debounce_active(&sensor->debounce) && sensor->debounce.level != sensor->debounce.value);
+    uint32_t      longer  = poll->period ? poll->period * 2 : 10;
+
+    sensor->polled = value;
+    if ( active ) {
+        poll->period = poll->freq;
+    } else if ( poll->period < poll->freq_max ) {
+        poll->period = (longer < poll->freq_max) ? longer : poll->freq_max;
+    }
+}
+
+void pollSensor(char* id, uint32_t index, uint64_t now) {
+    sensor_poll_t *poll      = &sensors.poll[index];
+    uint64_t      *next_read = &sensors.next_read[index];
+    uint64_t      period     = (uint64_t)poll->period * 1000;
+    uint64_t      sampled    = monotonic_timestamp();
+    bool          due        = *next_read <= now;
+
+    // edge triggered sensors are only here for the report cycle or a pending debounce
+    if ( poll->edge ) {
+        sensors.meta[index].recheck = 0;
+    }
+
+    // reads forced by a full report are off the grid and not measured
+    if ( sensors.last_sample[index] && due && !poll->edge ) {
+        recordSample(sensors.last_sample[index], *next_read, period, sampled, &sensors.meta[index].late_max);
+    }
+    sensors.last_sample[index] = due ? sampled : 0;
+
+    readSensor(id, index);
+
+    if ( !poll->edge ) {
+        if ( poll->freq_max ) {
+            adaptPeriod(index, sensors.value[index]);
+            period = (uint64_t)poll->period * 1000;
+        }
+        nextDue(next_read, period, now, due);
+        sched_push_slack(&schedule, *next_read, poll->tolerance, index);
+
+        if (debug>=2) {
+            log_msg(LOG_INFO, "Sensor %s next read in %llu usec",
+                    sensors.meta[index].label,
+                    (unsigned long long)(*next_read-now));
+        }
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * DIGITAL sensors polled at their fixed frequency, aggregated and adaptive ones keep
+ * their own schedule
+ * ---------------------------------------------------------------------------------------
+ */
+static bool bankable(uint32_t index) {
+    return sensors.meta[index].type == DIGITAL && !sensors.poll[index].edge && !sensors.poll[index].freq_max &&
+           !aggregate_active(&sensors.meta[index].aggregate);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Put every polled DIGITAL sensor into the bank, one line per pin. Pins that also have
+ * an edge triggered sensor stay out (their line is already requested for events), as do
+ * pins beyond the first GPIO_BANK_MAX, their sensors are read one by one. A line is
+ * inverted if its first sensor is, other sensors on it flip the bit themselves.
+ * ---------------------------------------------------------------------------------------
+ */
+void setupBank(void) {
+    uint32_t freq = bank.freq;
+
+    bank.lines     = 0;
+    bank.invert    = 0;
+    bank.freq      = UINT32_MAX;
+    bank.tolerance = UINT32_MAX;
+    bank.valid   = false;
+    bank.pending = 0;
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        sensors.meta[index].banked = false;
+    }
+    if ( !gpio_bank_mode ) {
+        gpio_bank(NULL, 0);
+        return;
+    }
+
+    for ( int pin=0; pin<SENSOR_PINS; pin++ ) {
+        bool polled = false, watched = false;
+
+        for ( uint32_t index=sensors.pin_first[pin]; index!=SENSOR_NONE; index=sensors.pin_next[index] ) {
+            polled  |= bankable(index);
+            watched |= sensors.poll[index].edge;
+        }
+        if ( !polled || watched ) {
+            continue;
+        }
+        if ( bank.lines == GPIO_BANK_MAX ) {
+            log_msg(LOG_WARNING, "More than %d digital lines, reading pin %d on its own", GPIO_BANK_MAX, pin);
+            continue;
+        }
+        for ( uint32_t index=sensors.pin_first[pin]; index!=SENSOR_NONE; index=sensors.pin_next[index] ) {
+            sensor_t *sensor = &sensors.meta[index];
+
+            if ( bankable(index) ) {
+                if ( polled && sensor->invert ) {
+                    bank.invert |= (uint64_t)1 << bank.lines;
+                }
+                polled         = false;
+                sensor->banked = true;
+                if ( sensors.poll[index].freq < bank.freq ) {
+                    bank.freq = sensors.poll[index].freq;
+                }
+                if ( sensors.poll[index].tolerance < bank.tolerance ) {
+                    bank.tolerance = sensors.poll[index].tolerance;
+                }
+            }
+        }
+        bank.pins[bank.lines++] = pin;
+    }
+
+    if ( !gpio_bank(bank.pins, bank.lines) ) {
+        log_msg(LOG_ERR, "Error: could not set up %d digital lines, reading them one by one", bank.lines);
+        bank.lines = 0;
+    }
+    if ( bank.lines == 0 ) {
+        for ( size_t index=0; index<sensors.count; index++ ) {
+            sensors.meta[index].banked = false;
+        }
+    }
+    // a new frequency starts a new grid
+    if ( bank.freq != freq ) {
+        bank.next_read   = 0;
+        bank.last_sample = 0;
+    }
+    if ( debug && bank.lines ) {
+        log_msg(LOG_INFO, "Reading %d digital lines at once every %u msecs", bank.lines, bank.freq);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Timer slack lets the kernel fire our timers up to that much late, so it can serve
+ * them along with other wakeups. The main loop asks to be woken timer_slack before the
+ * scheduler's latest on-time wakeup, which is never before the first deadline as long
+ * as no scheduled read has less tolerance. Without tolerances the kernel default stays.
+ * The reactor's timerfd ignores timer slack, it sleeps until the wakeup itself.
+ * ---------------------------------------------------------------------------------------
+ */
+void applyTolerance(void) {
+    uint32_t slack = UINT32_MAX;
+
+    if ( reactor ) {
+        timer_slack = 0;
+        return;
+    }
+
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        sensor_poll_t *poll = &sensors.poll[index];
+
+        if ( !poll->edge && !sensors.meta[index].banked && poll->tolerance < slack ) {
+            slack = poll->tolerance;
+        }
+    }
+    if ( bank.lines && bank.tolerance < slack ) {
+        slack = bank.tolerance;
+    }
+    timer_slack = (slack == UINT32_MAX) ? 0 : slack;
+    if ( prctl(PR_SET_TIMERSLACK, (unsigned long)timer_slack * 1000, 0, 0, 0) == -1 ) {
+        log_msg(LOG_WARNING, "Could not set timer slack to %u usec", timer_slack);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Read all lines of the bank and put it back on the schedule. XOR with the last read
+ * leaves the changed lines, only their sensors are compared and published, so a pass
+ * costs the same however many inputs there are as long as they don't all change. A
+ * forced read (full report) goes through every line.
+ * ---------------------------------------------------------------------------------------
+ */
+void sampleBank(char* id, uint64_t now, bool force) {
+    uint64_t period  = (uint64_t)bank.freq * 1000;
+    uint64_t sampled = monotonic_timestamp();
+    bool     due     = bank.next_read <= now;
+    uint64_t start, values, changed, duration;
+
+    // reads forced by a full report are off the grid and not measured
+    if ( bank.last_sample && due ) {
+        recordSample(bank.last_sample, bank.next_read, period, sampled, &bank.late_max);
+    }
+    bank.last_sample = due ? sampled : 0;
+
+    start    = stats_timestamp();
+    values   = gpio_read_bank() ^ bank.invert;
+    duration = stats_timestamp() - start;
+    stats_record(STATS_READ_DIGITAL, duration);
+    bank.reads++;
+    if ( duration > bank.read_max ) {
+        bank.read_max = duration;
+    }
+
+    // lines with a change the debounce filter still holds back are looked at as well
+    changed       = values ^ bank.last;
+    bank.changes += __builtin_popcountll(changed);
+    changed      |= bank.pending;
+    if ( force || !bank.valid ) {
+        changed = (bank.lines == GPIO_BANK_MAX) ? UINT64_MAX : ((uint64_t)1 << bank.lines) - 1;
+    }
+    bank.last    = values;
+    bank.valid   = true;
+    bank.pending = 0;
+
+    while ( changed ) {
+        int      bit   = __builtin_ctzll(changed);
+        uint8_t  pin   = bank.pins[bit];
+        uint16_t level = (values >> bit) & 1;
+
+        changed &= changed - 1;
+        for ( uint32_t index=sensors.pin_first[pin]; index!=SENSOR_NONE; index=sensors.pin_next[index] ) {
+            sensor_t *sensor = &sensors.meta[index];
+
+            if ( sensor->banked ) {
+                uint16_t new_value = level ^ (sensor->invert != ((bank.invert >> bit) & 1));
+
+                new_value = filterValue(index, new_value, sampled);
+                if ( sensor->debounce.level != sensor->debounce.value ) {
+                    bank.pending |= (uint64_t)1 << bit;
+                }
+                if ( sensors.value[index] != new_value ) {
+                    sensors.value[index] = new_value;
+                    publishValue(id, index);
+                }
+            }
+        }
+    }
+
+    if ( bank.next_read == 0 ) {
+        bank.next_read = now + period;
+    } else {
+        nextDue(&bank.next_read, period, now, due);
+    }
+    sched_push_slack(&schedule, bank.next_read, bank.tolerance, BANK_ENTRY);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Spread sensors with the same frequency evenly over their period, so they don't all
+ * come due at once. Sets the first due time of every sensor that has none yet.
+ * ---------------------------------------------------------------------------------------
+ */
+static int compareFreq(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    if ( sensors.poll[x].freq != sensors.poll[y].freq ) {
+        return (sensors.poll[x].freq > sensors.poll[y].freq) - (sensors.poll[x].freq < sensors.poll[y].freq);
+    }
+    return (x > y) - (x < y);
+}
+
+void spreadSensors(uint64_t start) {
+    uint32_t *order = malloc(sensors.count * sizeof(uint32_t));
+    size_t   count  = 0;
+
+    if ( !order ) {
+        for ( size_t index=0; index<sensors.count; index++ ) {
+            if ( sensors.next_read[index] == 0 ) {
+                sensors.next_read[index] = start;
+            }
+        }
+        return;
+    }
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        if ( sensors.next_read[index] == 0 ) {
+            order[count++] = index;
+        }
+    }
+    qsort(order, count, sizeof(uint32_t), compareFreq);
+
+    for ( size_t first=0, last; first<count; first=last ) {
+        uint64_t period = (uint64_t)sensors.poll[order[first]].freq * 1000;
+
+        for ( last=first; last<count && sensors.poll[order[last]].freq == sensors.poll[order[first]].freq; last++ ) {
+        }
+        for ( size_t k=first; k<last; k++ ) {
+            sensors.next_read[order[k]] = start + period * (k - first) / (last - first);
+        }
+    }
+    free(order);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Request edge events for a sensor set up after startup, in reactor mode the new line fd
+ * has to go into the event loop as well
+ * ---------------------------------------------------------------------------------------
+ */
+bool watchSensor(sensor_t *sensor) {
+    int fds[64];
+    int before = gpio_fds(fds, 64), count;
+
+    gpio_debounce(sensor->pin, debounce_stable[sensor->pin] * 1000);
+    if ( !gpio_watch(sensor->pin) ) {
+        return false;
+    }
+    count = gpio_fds(fds, 64);
+    for ( int i=before; reactor && i<count; i++ ) {
+        if ( !reactor_add(fds[i], REACTOR_GPIO, false) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Reload the configuration and apply it to the running table. Sensors are matched by
+ * pin, type and label: matched ones keep their last value, statistics and place on the
+ * grid (unless their frequency or mode changed), new ones are set up as at startup and
+ * publish with their first read, removed ones are dropped. The broker connection stays,
+ * so nothing that did not change is sent again.
+ * ---------------------------------------------------------------------------------------
+ */
+static int compareKey(const void *a, const void *b) {
+    const sensor_t *x = *(sensor_t * const *)a;
+    const sensor_t *y = *(sensor_t * const *)b;
+
+    if ( x->pin != y->pin ) {
+        return (x->pin > y->pin) - (x->pin < y->pin);
+    }
+    if ( x->type != y->type ) {
+        return (x->type > y->type) - (x->type < y->type);
+    }
+    return strcmp(x->label, y->label);
+}
+
+void reloadConfig(char* id) {
+    uint64_t       start     = monotonic_timestamp();
+    sensor_table_t old       = sensors;
+    size_t         old_count = old.count;
+    sensor_t       **order   = NULL, **end;
+    uint32_t *map      = NULL, *list = NULL;
+    uint32_t added = 0, removed = 0, changed = 0;
+    bool     need_reader = false;
+
+    reload_pending = 0;
+    log_msg(LOG_INFO, "Received SIGHUP signal, reloading %s", configFile);
+
+    // batched changes refer to sensors by index
+    flushBatch(id, true);
+
+    sensors_init(&sensors);
+    reloading = true;
+    readConfig();
+    reloading = false;
+
+    if ( sensors.count == 0 ||
+         !(order = malloc(old_count * sizeof(sensor_t*))) ||
+         !(map   = malloc(old_count * sizeof(uint32_t))) ||
+         !(list  = realloc(batch_list, sensors.count * sizeof(uint32_t))) ) {
+        log_msg(LOG_ERR, "Error: reloading %s failed, keeping the running configuration", configFile);
+        for ( size_t index=0; index<sensors.count; index++ ) {
+            free(sensors.meta[index].label);
+        }
+        sensors_free(&sensors);
+        free(order);
+        free(map);
+        sensors = old;
+        reload_stats.failed++;
+        return;
+    }
+    batch_list = list;
+
+    // banked lines may become edge triggered, setupBank() requests them again
+    gpio_bank(NULL, 0);
+
+    for ( size_t index=0; index<old_count; index++ ) {
+        order[index] = &old.meta[index];
+        map[index]   = SPOOL_NO_SENSOR;
+    }
+    qsort(order, old_count, sizeof(sensor_t*), compareKey);
+    end = order + old_count;
+
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        sensor_t *sensor = &sensors.meta[index];
+        sensor_t **match = bsearch(&sensor, order, old_count, sizeof(sensor_t*), compareKey);
+
+        // the same sensor may be configured twice, pair them up in order
+        while ( match && match > order && !compareKey(match-1, &sensor) ) {
+            match--;
+        }
+        while ( match && match < end && !compareKey(match, &sensor) && map[*match - old.meta] != SPOOL_NO_SENSOR ) {
+            match++;
+        }
+        if ( match && (match == end || compareKey(match, &sensor)) ) {
+            match = NULL;
+        }
+
+        if ( match ) {
+            sensor_t      *was      = *match;
+            size_t        from      = was - old.meta;
+            sensor_poll_t *poll     = &sensors.poll[index];
+            sensor_poll_t *was_poll = &old.poll[from];
+
+            map[from] = index;
+            free(sensor->label);
+            sensor->label        = was->label;
+            sensor->topic        = was->topic;
+            sensor->topic_length = was->topic_length;
+            sensor->json         = was->json;
+            sensor->json_length  = was->json_length;
+            sensor->reads        = was->reads;
+            sensor->read_max     = was->read_max;
+            sensor->late_max     = was->late_max;
+            sensors.value[index] = old.value[from];
+            sensor->changed      = was->changed;
+            sensor->quality      = was->quality;
+            debounce_setup(&was->debounce, sensor->debounce.stable, sensor->debounce.max_flips);
+            sensor->debounce     = was->debounce;
+            aggregate_setup(&was->aggregate, sensor->aggregate.window);
+            sensor->aggregate    = was->aggregate;
+            if ( poll->freq == was_poll->freq && poll->freq_max == was_poll->freq_max && poll->edge == was_poll->edge ) {
+                sensors.next_read[index]   = old.next_read[from];
+                sensors.last_sample[index] = old.last_sample[from];
+                poll->period               = was_poll->period;
+                sensor->polled             = was->polled;
+            }
+            if ( poll->freq != was_poll->freq || poll->freq_max != was_poll->freq_max ||
+                 poll->edge != was_poll->edge || sensor->invert != was->invert ) {
+                changed++;
+            }
+            if ( poll->edge && !was_poll->edge && !watchSensor(sensor) ) {
+                log_msg(LOG_WARNING, "No edge events for pin %d, polling '%s' instead",
+                        sensor->pin, sensor->label);
+                poll->edge = false;
+            }
+        } else {
+            added++;
+            gpio_input(sensor->pin);
+            if ( sensors.poll[index].edge && !watchSensor(sensor) ) {
+                log_msg(LOG_WARNING, "No edge events for pin %d, polling '%s' instead",
+                        sensor->pin, sensor->label);
+                sensors.poll[index].edge = false;
+            }
+        }
+        // lines watched before keep the kernel debounce they were requested with
+        if ( sensors.poll[index].edge && gpio_debounced(sensor->pin) ) {
+            debounce_setup(&sensor->debounce, 0, sensor->debounce.max_flips);
+        }
+        need_reader |= (sensor->type != DIGITAL);
+    }
 
-/*
- * ---------------------------------------------------------------------------------------
- * Some globals we can't do without... ;)
- * ---------------------------------------------------------------------------------------
- */
-int      pidFilehandle    = 0;
-bool     deamon           = true;
-int8_t   debug            = DEBUG;
-char     *prefix          = PREFIX;
-char     *pidfile         = PID_FILE;
-char     *configFile      = CONFIG_FILE;
-char     *mqtt_broker_ip  = MQTT_BROKER_IP;
-int      mqtt_broker_port = MQTT_BROKER_PORT;
-int      mqtt_keepalive   = MQTT_KEEPALIVE;
-char*    mqtt_interface   = MQTT_INTERFACE;
-uint64_t report_cycle     = REPORT_CYCLE;
+    // edge events keep coming for pins nobody listens to any more, handleEvent() ignores them
+    for ( size_t index=0; index<old_count; index++ ) {
+        if ( map[index] == SPOOL_NO_SENSOR ) {
+            removed++;
+            free(old.meta[index].label);
+            free(old.meta[index].topic);
+            free(old.meta[index].json);
+        }
+    }
+    sensors_free(&old);
+    free(order);
 
-/*
- * ---------------------------------------------------------------------------------------
- * sensor specific data
- * ---------------------------------------------------------------------------------------
- */
-typedef enum { DIGITAL, DHT11_TMP, DHT11_HMD } sensorType_t;
+    prepareTopics(id);
+    if ( spool_file ) {
+        spool_remap(map, old_count, configSignature());
+    }
+    if ( journal_dir && !journalSensors() ) {
+        log_msg(LOG_ERR, "Could not start a journal segment for the new sensor table");
+    }
+    if ( shared_memory && !sharedSensors() ) {
+        log_msg(LOG_ERR, "Could not put the new sensor table into shared memory %s", shared_memory);
+    }
+    free(map);
 
-typedef struct {
-    uint8_t       pin;
-    sensorType_t  type;
-    uint32_t      freq;
-    char          *label;
-    bool          invert;
-    uint16_t      value;
-    uint64_t      next_read;
-} sensor_t;
+    if ( need_reader && dht11_result_fd() == -1 &&
+         !(dht11_reader_start(dht11_priority, dht11_freshness, dht11_interval) && wakeOn(dht11_result_fd())) ) {
+        log_msg(LOG_ERR, "Could not start DHT11 reader thread");
+    }
 
-sensor_t sensor_list[MAX_SENSORS];
+    // new sensors and new frequencies get a phase, everybody else stays on the grid. New
+    // edge triggered sensors are read once, they would not report before the next edge,
+    // new banked ones with the next bank read. Debounced edge triggered sensors are read
+    // as well, a pending change lost its place on the schedule.
+    setupBank();
+    applyTolerance();
+    sched_clear(&schedule);
+    spreadSensors(monotonic_timestamp());
+    for ( uint32_t index=0; index<sensors.count; index++ ) {
+        if ( sensors.meta[index].banked ) {
+            continue;
+        } else if ( !sensors.poll[index].edge ) {
+            sched_push_slack(&schedule, sensors.next_read[index], sensors.poll[index].tolerance, index);
+        } else if ( sensors.value[index] == RESET_VALUE || debounce_active(&sensors.meta[index].debounce) ) {
+            readSensor(id, index);
+        }
+    }
+    if ( bank.lines ) {
+        sched_push_slack(&schedule, bank.next_read ? bank.next_read : monotonic_timestamp(),
+                         bank.tolerance, BANK_ENTRY);
+    }
 
-/*
- * ---------------------------------------------------------------------------------------
- * Function prototypes
- * ---------------------------------------------------------------------------------------
- */
-void readSensor(char* id, int pin, char* name, bool invert, sensorType_t type, uint16_t* value);
-bool get_id ( char* id );
-void sigendCB(int sigval);
-void shutdown_daemon(void);
-uint8_t readConfig(void);
+    reload_stats.reloads++;
+    reload_stats.silence_last = monotonic_timestamp() - start;
+    reload_stats.latency_last = monotonic_timestamp() - reload_requested;
+    if ( reload_stats.silence_last > reload_stats.silence_max ) {
+        reload_stats.silence_max = reload_stats.silence_last;
+    }
+    if ( reload_stats.latency_last > reload_stats.latency_max ) {
+        reload_stats.latency_max = reload_stats.latency_last;
+    }
+    log_msg(LOG_INFO, "Configuration reloaded: %zu sensors, %u added, %u removed, %u changed, "
+            "%llu usec after SIGHUP, sensor loop stopped for %llu usec",
+            sensors.count, added, removed, changed,
+            (unsigned long long)reload_stats.latency_last,
+            (unsigned long long)reload_stats.silence_last);
+}
 
 /*
  * ---------------------------------------------------------------------------------------
- * there are many ways to die
+ * Edge event on a watched pin, publish right away for every edge triggered sensor on it
  * ---------------------------------------------------------------------------------------
  */
-void sigendCB(int sigval)
-{
-    switch(sigval)
-    {
-        case SIGHUP:
-            syslog(LOG_WARNING, "Received SIGHUP signal.");
-            break;
-        case SIGINT:
-        case SIGTERM:
-            syslog(LOG_INFO, "Daemon exiting");
-            shutdown_daemon();
-            exit(EXIT_SUCCESS);
-            break;
-        default:
-            syslog(LOG_WARNING, "Unhandled signal %s", strsignal(sigval));
-            break;
+void handleEvent(char* id, gpio_event_t *event) {
+    for ( uint32_t index=sensors.pin_first[event->pin]; index!=SENSOR_NONE; index=sensors.pin_next[index] ) {
+        sensor_t *sensor = &sensors.meta[index];
+
+        if ( sensors.poll[index].edge ) {
+            uint16_t new_value = filterValue(index, sensor->invert ? !event->value : event->value,
+                                             event->timestamp);
+
+            if ( sensors.value[index] != new_value ) {
+                sensors.value[index] = new_value;
+                publishValue(id, index);
+                if (debug>=2) {
+                    log_msg(LOG_INFO, "Sensor %s edge published %llu usec after event",
+                            sensor->label, (unsigned long long)(gpio_timestamp() - event->timestamp));
+                }
+            }
+        }
     }
 }
 
 /*
  * ---------------------------------------------------------------------------------------
- * shutdwown deamon
+ * DHT11 transaction finished, publish the values for every DHT11 sensor on that pin
  * ---------------------------------------------------------------------------------------
  */
-void shutdown_daemon(void) {
-    closelog();
-    mqtt_end();
-    if (deamon) {
-        close(pidFilehandle);
-        unlink(pidfile);
+void handleResult(char* id, dht11_result_t *result) {
+    if ( !result->success ) {
+        if ( debug>=2 ) {
+            log_msg(LOG_INFO, "DHT11 @ pin %d: checksum error", result->pin);
+        }
+        return;
+    }
+    for ( uint32_t index=sensors.pin_first[result->pin]; index!=SENSOR_NONE; index=sensors.pin_next[index] ) {
+        sensor_t *sensor = &sensors.meta[index];
+
+        if ( sensor->type != DIGITAL ) {
+            uint16_t new_value = (sensor->type == DHT11_TMP) ? result->celcius : result->humidity;
+
+            sensor->reads++;
+            if ( result->duration > sensor->read_max ) {
+                sensor->read_max = result->duration;
+            }
+
+            if ( aggregate_active(&sensor->aggregate) ) {
+                aggregateValue(id, index, new_value, monotonic_timestamp());
+            } else if ( sensors.value[index] != new_value ) {
+                sensors.value[index] = new_value;
+                publishValue(id, index);
+            }
+        }
     }
 }
 
 /*
  * ---------------------------------------------------------------------------------------
- * get the last two bytes of the MAC address of the MQTT_INTERFACE
+ * Have the main loop wake up when fd becomes readable
  * ---------------------------------------------------------------------------------------
  */
-bool get_id ( char* id ) {
-    bool success = false;
-    struct ifreq s;
-    int fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
-    
-    strcpy(s.ifr_name, mqtt_interface );
-    if (0 == ioctl(fd, SIOCGIFHWADDR, &s)) {
-        sprintf(id, "%02x%02x",s.ifr_addr.sa_data[4], s.ifr_addr.sa_data[5]);
-        success = true;
-    } else {
-        success = false;
-    }
-    return success;
+bool wakeOn(int fd) {
+    return reactor ? reactor_add(fd, REACTOR_WAKE, false) : gpio_wake_on(fd);
 }
 
 /*
  * ---------------------------------------------------------------------------------------
- * Read sensor and publish value to MQTT broker
+ * Reactor mode: sleep in epoll until next_time, publishing edge events, serving the
+ * MQTT socket and handling signals as they come in. Returns early when a wake fd (DHT11
+ * results, stats client) becomes readable.
  * ---------------------------------------------------------------------------------------
  */
-void readSensor(char* id, int pin, char* name, bool invert, sensorType_t type, uint16_t* old_value) {
-    char topic[32], msg[64];
-    uint16_t new_value;
-    
-    switch( type ) {
-        case DIGITAL:
-            new_value = digitalRead(pin);
-            if ( invert ) {
-                if ( new_value != 0 ) {
-                    new_value = 0;
-                } else {
-                    new_value = 1;
+void waitReactor(char* id, uint64_t next_time) {
+    static uint64_t next_service = 0;
+    static int      mqtt_fd      = -1;
+    static uint32_t mqtt_gen     = 0;
+    static bool     mqtt_writing = false;
+    reactor_event_t events[16];
+
+    for ( ;; ) {
+        uint64_t now     = monotonic_timestamp();
+        int      fd      = mqtt_socket();
+        bool     writing = mqtt_want_write();
+        bool     wake    = false, edges = false;
+        uint64_t deadline, next_edge;
+        int      count;
+
+        // the mosquitto socket changes with every reconnect, closing the old one took it
+        // out of epoll even if the new one got the same number
+        if ( fd != mqtt_fd || mqtt_generation() != mqtt_gen ) {
+            if ( mqtt_fd != -1 ) {
+                reactor_remove(mqtt_fd);
+            }
+            if ( fd != -1 && !reactor_add(fd, REACTOR_MQTT, writing) ) {
+                fd = -1;
+            }
+            mqtt_fd      = fd;
+            mqtt_gen     = mqtt_generation();
+            mqtt_writing = writing;
+        } else if ( fd != -1 && writing != mqtt_writing ) {
+            if ( !reactor_modify(fd, REACTOR_MQTT, writing) && !reactor_add(fd, REACTOR_MQTT, writing) ) {
+                mqtt_fd = -1;
+            }
+            mqtt_writing = writing;
+        }
+
+        if ( now >= next_time ) {
+            return;
+        }
+        if ( now >= next_service ) {                    /* keepalive and reconnect     */
+            mqtt_service(false, false);
+            next_service = now + 1000000;
+            continue;
+        }
+
+        // both clocks are CLOCK_MONOTONIC usecs
+        deadline  = (next_service < next_time) ? next_service : next_time;
+        next_edge = gpio_next_event();
+        if ( next_edge < deadline ) {
+            deadline = (next_edge > now) ? next_edge : now + 1;
+        }
+        reactor_arm(deadline);
+
+        count = reactor_wait(events, 16);
+        if ( count == -1 ) {
+            log_msg(LOG_ERR, "Error: waiting for events failed");
+            usleep(deadline - now);
+            return;
+        }
+        for ( int i=0; i<count; i++ ) {
+            switch ( events[i].source ) {
+                case REACTOR_SIGNAL: {
+                    int sig;
+                    while ( (sig = reactor_signal()) ) {
+                        sigendCB(sig);
+                    }
+                    wake |= reload_pending || exit_pending;
+                    break;
                 }
+                case REACTOR_MQTT:
+                    mqtt_service(events[i].readable, events[i].writable);
+                    break;
+                case REACTOR_WAKE:
+                    wake = true;
+                    break;
+                case REACTOR_GPIO:
+                case REACTOR_TIMER:
+                    edges = true;
+                    break;
+            }
+        }
+
+        // line events, or the timer went off for a simulated edge
+        if ( edges ) {
+            gpio_event_t event;
+            while ( gpio_wait(0, &event) == 1 ) {
+                handleEvent(id, &event);
+                flushBatch(id, false);
             }
-            break;
-        case DHT11_TMP:
-            dht11_read_val( pin, &new_value, NULL );
-            break;
-            
-        case DHT11_HMD:
-            dht11_read_val( pin, NULL, &new_value );
-            break;
-            
-        default:
-            syslog(LOG_ERR, "Unknown sensor type");
-            break;
-    }
-    
-    if ( *old_value != new_value ) {
-        *old_value = new_value;
-        
-        sprintf(topic, "%s/%s-%s/%d", name, prefix, id, pin);
-        sprintf(msg, "{\"%s\":\"%d\"}", name, new_value);
-        if ( debug ) {
-            syslog(LOG_INFO, "%s: %d", name, new_value);
         }
-        if ( ! mqtt_publish( topic, msg ) ) {
-            syslog(LOG_ERR, "Error: Did not publish message: %s\n", msg);
+        if ( batchDeadline() < next_time ) {
+            next_time = batchDeadline();
+        }
+        if ( wake ) {
+            return;
         }
     }
 }
 
 /*
  * ---------------------------------------------------------------------------------------
- * Get surrent time in milliseconds
+ * Get current time in microseconds on CLOCK_MONOTONIC
+ * ---------------------------------------------------------------------------------------
+ */
+uint64_t monotonic_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Get surrent time in milliseconds since the epoch, only for timestamps in messages,
+ * scheduling runs on monotonic_timestamp() (usecs) so clock steps don't disturb it
  * ---------------------------------------------------------------------------------------
  */
-uint64_t current_timestamp() {
+uint64_t current_timestamp(void) {
     struct timeval te;
     gettimeofday(&te, NULL);                                    // get current time
     uint64_t milliseconds = te.tv_sec*1000LL + te.tv_usec/1000; // calculate milliseconds
@@ -237,15 +1955,46 @@ uint64_t current_timestamp() {
 /* *********************************************************************************** */
 char *nextValue( char **cursor) {
     while (**cursor && **cursor != ' ') (*cursor)++;                   /*   skip token */
-    **cursor = '\0'; (*cursor)++;                                      /* end of token */
+    if (**cursor) { **cursor = '\0'; (*cursor)++; }                    /* end of token */
     while (**cursor && **cursor == ' ') (*cursor)++;                   /* skip spaces  */
     return *cursor;
 }
 
-uint8_t readConfig(void) {
+/*
+ * a number from 0 to max, false if it is missing or anything else
+ */
+bool configNumber( const char *text, long max, long *number ) {
+    char *end;
+
+    *number = strtol(text, &end, 10);
+    return end != text && (*end == '\0' || *end == ' ') && *number >= 0 && *number <= max;
+}
+
+/*
+ * settings a running daemon takes over on SIGHUP, everything else needs a restart
+ */
+bool reloadable( const char *token ) {
+    static const char *tokens[] = { "SENSOR", "DEBUG", "REPORT_CYCLE", "BATCH_WINDOW",
+                                    "STATS_INTERVAL", "SPOOL_RATE", "DEBOUNCE", "TOLERANCE", NULL };
+
+    for ( int i=0; tokens[i]; i++ ) {
+        if ( !strcmp(token, tokens[i]) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * SENSOR lines are added to the (empty) sensors table
+ */
+size_t readConfig(void) {
     FILE *fp = NULL;
     fp = fopen(configFile, "rb");
-    uint8_t num_sensors=0;
+
+    memset(debounce_stable, 0, sizeof(debounce_stable));
+    memset(debounce_flips, 0, sizeof(debounce_flips));
+    memset(tolerance, 0, sizeof(tolerance));
  
     if (fp) {
         char  *line=NULL;
@@ -255,7 +2004,7 @@ uint8_t readConfig(void) {
         
         /* FIXME: look for a lib to read confoig values and replace this hack...       */
 
-        syslog(LOG_INFO, "Reading configuration from %s", configFile);
+        log_msg(LOG_INFO, "Reading configuration from %s", configFile);
         
         while ( length != -1) {
             if ( length > 1 ) {                              /* skip empty lines       */
@@ -268,7 +2017,9 @@ uint8_t readConfig(void) {
                     char *token = cursor;
                     char *value = nextValue(&cursor);
 
-                    if (!strcmp(token, "MQTT_BROKER_IP")) {
+                    if ( reloading && !reloadable(token) ) {
+                        // keep what the daemon was started with
+                    } else if (!strcmp(token, "MQTT_BROKER_IP")) {
                         mqtt_broker_ip = strdup(value);
                     } else if (!strcmp(token, "MQTT_BROKER_PORT")) {
                         mqtt_broker_port = atoi(value);
@@ -278,48 +2029,192 @@ uint8_t readConfig(void) {
                         mqtt_interface = strdup(value);
                     } else if (!strcmp(token, "MQTT_KEEPALIVE")) {
                         mqtt_keepalive = atoi(value);
+                    } else if (!strcmp(token, "MQTT_QOS")) {
+                        mqtt_qos = atoi(value);
+                    } else if (!strcmp(token, "MQTT_INFLIGHT")) {
+                        mqtt_inflight = atoi(value);
+                    } else if (!strcmp(token, "MQTT_ASYNC")) {
+                        mqtt_async = atoi(value);
+                    } else if (!strcmp(token, "REACTOR")) {
+                        reactor = atoi(value);
                     } else if (!strcmp(token, "DEBUG")) {
                         debug = atoi(value);
                     } else if (!strcmp(token, "REPORT_CYCLE")) {
                         report_cycle = atoi(value) * 10;
                     } else if (!strcmp(token, "PID_FILE")) {
                         pidfile = strdup(value);
+                    } else if (!strcmp(token, "GPIO_BACKEND")) {
+                        gpio_type = strcmp(value, "SIM") ? GPIO_WIRINGPI : GPIO_SIM;
+                    } else if (!strcmp(token, "GPIO_CHIP")) {
+                        gpio_chip = strdup(value);
+                    } else if (!strcmp(token, "GPIO_BANK")) {
+                        gpio_bank_mode = atoi(value);
+                    } else if (!strcmp(token, "DEBOUNCE")) {
+                        // Read: Pin Stable [MaxFlips]
+                        char *s_stable = nextValue(&cursor);
+                        char *s_flips  = nextValue(&cursor); // optional
+                        long pin, stable, flips = 0;
+                        if ( !configNumber(value, SENSOR_PINS-1, &pin) ||
+                             !configNumber(s_stable, UINT32_MAX/1000, &stable) ||
+                             (*s_flips && !configNumber(s_flips, UINT16_MAX, &flips)) ) {
+                            log_msg(LOG_WARNING, "Warning: DEBOUNCE needs a pin below %d and a Stable time, "
+                                    "ignoring the one for pin '%s'", SENSOR_PINS, value);
+                        } else {
+                            debounce_stable[pin] = stable;
+                            debounce_flips[pin]  = flips;
+                        }
+                    } else if (!strcmp(token, "TOLERANCE")) {
+                        // Read: Pin Lateness
+                        char *s_late = nextValue(&cursor);
+                        long pin, late;
+                        if ( !configNumber(value, SENSOR_PINS-1, &pin) ||
+                             !configNumber(s_late, UINT32_MAX/1000, &late) ) {
+                            log_msg(LOG_WARNING, "Warning: TOLERANCE needs a pin below %d and a Lateness, "
+                                    "ignoring the one for pin '%s'", SENSOR_PINS, value);
+                        } else {
+                            tolerance[pin] = late;
+                        }
+                    } else if (!strcmp(token, "GPIO_SIM_FIFO")) {
+                        gpio_sim_fifo = strdup(value);
+                    } else if (!strcmp(token, "GPIO_SIM_EPOCH")) {
+                        gpio_sim_epoch(strtoull(value, NULL, 10));
+                    } else if (!strcmp(token, "SIM_TOGGLE")) {
+                        // Read: Pin Period [Phase] [Noise]
+                        uint8_t  pin    = atoi(value);
+                        uint64_t period = strtoull(nextValue(&cursor), NULL, 10) * 1000;
+                        uint64_t phase  = strtoull(nextValue(&cursor), NULL, 10) * 1000;
+                        uint8_t  noise  = atoi(nextValue(&cursor));
+                        gpio_sim_toggle(pin, period, phase, noise);
+                    } else if (!strcmp(token, "SIM_DHT")) {
+                        // Read: Pin Humidity Celcius [Fail] [Jitter]
+                        uint8_t  pin      = atoi(value);
+                        uint8_t  humidity = atoi(nextValue(&cursor));
+                        uint8_t  celcius  = atoi(nextValue(&cursor));
+                        uint8_t  fail     = atoi(nextValue(&cursor));
+                        uint16_t jitter   = atoi(nextValue(&cursor));
+                        gpio_sim_dht(pin, humidity, celcius, fail, jitter);
+                    } else if (!strcmp(token, "DHT11_PRIORITY")) {
+                        dht11_priority = atoi(value);
+                    } else if (!strcmp(token, "DHT11_FRESHNESS")) {
+                        dht11_freshness = atoi(value);
+                    } else if (!strcmp(token, "DHT11_INTERVAL")) {
+                        dht11_interval = atoi(value);
+                    } else if (!strcmp(token, "PUBLISH_MODE")) {
+                        if (!strcmp(value, "BATCH")) {
+                            publish_mode = PUBLISH_BATCH;
+                        } else if (!strcmp(value, "BOTH")) {
+                            publish_mode = PUBLISH_BOTH;
+                        } else {
+                            publish_mode = PUBLISH_SENSOR;
+                        }
+                    } else if (!strcmp(token, "REPORT_MODE")) {
+                        report_mode = strcmp(value, "RETAIN") ? REPORT_RESEND : REPORT_RETAIN;
+                    } else if (!strcmp(token, "PAYLOAD_FORMAT")) {
+                        payload_format = strcmp(value, "CBOR") ? FORMAT_JSON : FORMAT_CBOR;
+                    } else if (!strcmp(token, "BATCH_TOPIC")) {
+                        batch_topic = strdup(value);
+                    } else if (!strcmp(token, "BATCH_WINDOW")) {
+                        batch_window = atoi(value);
+                    } else if (!strcmp(token, "SPOOL_FILE")) {
+                        spool_file = strdup(value);
+                    } else if (!strcmp(token, "SPOOL_SIZE")) {
+                        spool_size = atoi(value);
+                    } else if (!strcmp(token, "SPOOL_RATE")) {
+                        spool_rate = atoi(value);
+                    } else if (!strcmp(token, "SPOOL_DROP")) {
+                        spool_drop_oldest = strcmp(value, "NEWEST");
+                    } else if (!strcmp(token, "JOURNAL_DIR")) {
+                        journal_dir = strdup(value);
+                    } else if (!strcmp(token, "JOURNAL_SIZE")) {
+                        journal_size = atoi(value);
+                    } else if (!strcmp(token, "JOURNAL_SEGMENT")) {
+                        journal_segment = atoi(value);
+                    } else if (!strcmp(token, "SHARED_MEMORY")) {
+                        shared_memory = strcmp(value, "NONE") ? strdup(value) : NULL;
+                    } else if (!strcmp(token, "STATS_SOCKET")) {
+                        stats_socket = strcmp(value, "NONE") ? strdup(value) : NULL;
+                    } else if (!strcmp(token, "SPOOL_TOPIC")) {
+                        spool_topic = strdup(value);
+                    } else if (!strcmp(token, "STATS_TOPIC")) {
+                        stats_topic = strdup(value);
+                    } else if (!strcmp(token, "STATS_INTERVAL")) {
+                        stats_interval = atoi(value) * 10;
+                    } else if (!strcmp(token, "LOG_RATE")) {
+                        log_rate = atoi(value);
                     } else if (!strcmp(token, "SENSOR")) {
-                        // Read: Pin Type Invert Frequency Label
-                        sensor_list[num_sensors].pin    = atoi(cursor);
-                        char *s_type                    = nextValue(&cursor); // need special handling
-                        sensor_list[num_sensors].invert = atoi(nextValue(&cursor));
-                        sensor_list[num_sensors].freq   = atoi(nextValue(&cursor)) * 10;
-                        sensor_list[num_sensors].label  = strdup(nextValue(&cursor));
+                        // make room for one more sensor
+                        sensor_t *sensor = sensors_add(&sensors);
+                        uint32_t index   = sensors.count - 1;
+                        if ( !sensor ) {
+                            log_msg(LOG_ERR, "Out of memory reading sensor %zu", sensors.count);
+                            exit(EXIT_FAILURE);
+                        }
+
+                        // Read: Pin Type Invert Frequency Label [Mode [Param]] [TOLERANCE Lateness]
+                        sensor->pin    = atoi(cursor);
+                        char *s_type   = nextValue(&cursor); // need special handling
+                        sensor->invert = atoi(nextValue(&cursor));
+                        int  s_freq    = atoi(nextValue(&cursor));
+                        char *s_label  = nextValue(&cursor);
+                        char *s_mode   = nextValue(&cursor); // optional
+                        char *s_param  = nextValue(&cursor); // AGGREGATE and ADAPTIVE only
+                        char *s_next   = nextValue(&cursor); // TOLERANCE after a mode
+                        char *s_last   = nextValue(&cursor); // ... that has a param
+                        sensor->label  = strdup(s_label);
+                        char *s_late   = !strcmp(s_mode,  "TOLERANCE") ? s_param :
+                                         !strcmp(s_param, "TOLERANCE") ? s_next  :
+                                         !strcmp(s_next,  "TOLERANCE") ? s_last  : NULL;
+                        long late      = -1;
+                        if ( s_late && !configNumber(s_late, UINT32_MAX/1000, &late) ) {
+                            log_msg(LOG_WARNING, "Warning: TOLERANCE of '%s' needs a Lateness, using the pin's", s_label);
+                            late = -1;
+                        }
+                        sensor->tolerance = late;
+                        sensors.poll[index].edge = !strcmp(s_mode, "EDGE");
+                        // a sensor due again right away would be read over and over in one pass
+                        if ( s_freq < 1 ) {
+                            log_msg(LOG_WARNING, "Warning: Frequency of '%s' must be at least 1, using 1", s_label);
+                            s_freq = 1;
+                        }
+                        sensors.poll[index].freq   = s_freq * 10;
+                        sensors.poll[index].period = sensors.poll[index].freq;
+                        if ( !strcmp(s_mode, "AGGREGATE") ) {
+                            aggregate_setup(&sensor->aggregate, (uint64_t)atoi(s_param) * 10000);
+                        } else if ( !strcmp(s_mode, "ADAPTIVE") && atoi(s_param) * 10 > sensors.poll[index].freq ) {
+                            sensors.poll[index].freq_max = atoi(s_param) * 10;
+                        }
 
                         // convert type string to enum
                         if (!strcmp(s_type, "DIGITAL")) {
-                            sensor_list[num_sensors].type = DIGITAL;
+                            sensor->type = DIGITAL;
                         } else if (!strcmp(s_type, "DHT11_TMP")) {
-                            sensor_list[num_sensors].type = DHT11_TMP;
+                            sensor->type = DHT11_TMP;
                         } else if (!strcmp(s_type, "DHT11_HMD")) {
-                            sensor_list[num_sensors].type = DHT11_HMD;
+                            sensor->type = DHT11_HMD;
                         } else {
-                            syslog(LOG_WARNING, "Warning: Unknown sensor type '%s'. Fall back to DIGITAL", s_type);
-                            sensor_list[num_sensors].type = DIGITAL;
+                            log_msg(LOG_WARNING, "Warning: Unknown sensor type '%s'. Fall back to DIGITAL", s_type);
+                            sensor->type = DIGITAL;
+                        }
+                        if ( sensors.poll[index].edge && sensor->type != DIGITAL ) {
+                            log_msg(LOG_WARNING, "Warning: EDGE mode needs a DIGITAL sensor, polling '%s'", s_label);
+                            sensors.poll[index].edge = false;
                         }
                         
-                        // initialize sensor readign with invalid value
-                        sensor_list[num_sensors].value     = RESET_VALUE;
-                        sensor_list[num_sensors].next_read = (uint64_t)0;
+                        // initialize sensor readign with invalid value, everything else is 0
+                        sensors.value[index] = RESET_VALUE;
                         
                         if ( debug ) {
-                            syslog(LOG_INFO, "%02d: %s sensor '%s' @ pin %d,%sinverted, read every %u uSecs",
-                                   num_sensors,
-                                   (sensor_list[num_sensors].type == DIGITAL)   ? "Digital"   :
-                                   (sensor_list[num_sensors].type == DHT11_TMP) ? "DHT11_TMP" :"DHT11_HMD",
-                                   sensor_list[num_sensors].label,
-                                   sensor_list[num_sensors].pin,
-                                   (sensor_list[num_sensors].invert ? " " : " not "),
-                                   sensor_list[num_sensors].freq
-                                   );
+                            log_msg(LOG_INFO, "%02u: %s sensor '%s' @ pin %d,%sinverted, %s every %u uSecs",
+                                    index,
+                                    (sensor->type == DIGITAL)   ? "Digital"   :
+                                    (sensor->type == DHT11_TMP) ? "DHT11_TMP" :"DHT11_HMD",
+                                    sensor->label,
+                                    sensor->pin,
+                                    (sensor->invert ? " " : " not "),
+                                    (sensors.poll[index].edge ? "edge triggered, full report" : "read"),
+                                    sensors.poll[index].freq
+                                    );
                         }
-                        num_sensors++;
                     }
                 }
             }
@@ -329,10 +2224,21 @@ uint8_t readConfig(void) {
         }
         fclose(fp);
     }
-    sensor_list[num_sensors].label  = NULL;
-    sensor_list[num_sensors].pin    = 0;
-    sensor_list[num_sensors].invert = 0;
-    return (num_sensors);
+
+    // DEBOUNCE and TOLERANCE lines may come before or after the sensors on their pin,
+    // a TOLERANCE on the SENSOR line wins over the pin's
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        sensor_t *sensor = &sensors.meta[index];
+
+        sensors.poll[index].tolerance = (sensor->tolerance >= 0 ? (uint32_t)sensor->tolerance :
+                                                                  tolerance[sensor->pin]) * 1000;
+        if ( sensor->type == DIGITAL ) {
+            debounce_setup(&sensor->debounce, debounce_stable[sensor->pin] * 1000,
+                           debounce_flips[sensor->pin]);
+        }
+    }
+    sensors_compile(&sensors);
+    return (sensors.count);
 }
 
 /*
@@ -357,25 +2263,31 @@ int main(int argc, char *argv[]) {
         if (!strcmp(argv[i], "-c")) {       /* '-c' specify configuration file         */
             configFile = strdup(argv[++i]);
         }
+        if (!strcmp(argv[i], "-f")) {       /* '-f' stay in the foreground             */
+            deamon = false;
+        }
     }
 
     /* ------------------------------------------------------------------------------- */
     /* Read configuration                                                              */
     /* ------------------------------------------------------------------------------- */
-    uint8_t num_sensors = readConfig();
-    if ( num_sensors==0) {
-        syslog(LOG_ERR, "No sensor configuration found in %s", configFile);
+    sensors_init(&sensors);
+    if ( readConfig()==0 || !sched_init(&schedule, sensors.count) ||
+         !(batch_list = malloc(sensors.count * sizeof(uint32_t))) ) {
+        log_msg(LOG_ERR, "No sensor configuration found in %s", configFile);
         exit(EXIT_FAILURE);
     }
     
     if (debug) {
-        syslog(LOG_INFO, "MQTT broker IP: %s",           mqtt_broker_ip);
-        syslog(LOG_INFO, "MQTT broker port: %d",         mqtt_broker_port);
-        syslog(LOG_INFO, "MQTT interface: %s",           mqtt_interface);
-        syslog(LOG_INFO, "MQTT keepalive: %d",           mqtt_keepalive);
-        syslog(LOG_INFO, "PREFIX: %s",                   prefix);
-        syslog(LOG_INFO, "Full report every %llu uSec", report_cycle);
-        syslog(LOG_INFO, "pid/lock file: %s",            pidfile);
+        log_msg(LOG_INFO, "MQTT broker IP: %s",           mqtt_broker_ip);
+        log_msg(LOG_INFO, "MQTT broker port: %d",         mqtt_broker_port);
+        log_msg(LOG_INFO, "MQTT interface: %s",           mqtt_interface);
+        log_msg(LOG_INFO, "MQTT keepalive: %d",           mqtt_keepalive);
+        log_msg(LOG_INFO, "MQTT QoS: %d, in flight: %d, %s", mqtt_qos, mqtt_inflight,
+                mqtt_async ? "asynchronous" : "synchronous");
+        log_msg(LOG_INFO, "PREFIX: %s",                   prefix);
+        log_msg(LOG_INFO, "Full report every %llu uSec", report_cycle);
+        log_msg(LOG_INFO, "pid/lock file: %s",            pidfile);
     }
     
     /* ------------------------------------------------------------------------------- */
@@ -393,12 +2305,12 @@ int main(int argc, char *argv[]) {
         umask(0);                           /* Change the file mode mask               */
         pid_t sid = setsid();               /* Create a new SID for the child process  */
         if (sid < 0) {
-            syslog(LOG_ERR, "Could not get SID");
+            log_msg(LOG_ERR, "Could not get SID");
             exit(EXIT_FAILURE);
         }
         
         if ((chdir("/tmp")) < 0) {          /* Change the current working directory    */
-            syslog(LOG_ERR, "Could not chage working dir to /tmp");
+            log_msg(LOG_ERR, "Could not chage working dir to /tmp");
             exit(EXIT_FAILURE);
         }
         
@@ -407,7 +2319,7 @@ int main(int argc, char *argv[]) {
         dup(fd);                            /* STDOUT to /dev/null                     */
         dup(fd);                            /* STDERR to /dev/null                     */
     } else {
-        syslog(LOG_INFO, "Not demonizing");
+        log_msg(LOG_INFO, "Not demonizing");
     }
     
     /* ------------------------------------------------------------------------------- */
@@ -422,115 +2334,374 @@ int main(int argc, char *argv[]) {
                 sprintf(buffer,"%d\n",getpid());              /* Get and format PID    */
                 write(pidFilehandle, buffer, strlen(buffer)); /* write pid to lockfile */
             } else {
-                syslog(LOG_INFO, "Could not lock PID lock file %s, exiting", pidfile);
+                log_msg(LOG_INFO, "Could not lock PID lock file %s, exiting", pidfile);
                 exit(EXIT_FAILURE);
             }
         } else {
-            syslog(LOG_INFO, "Could not open PID lock file %s, exiting", pidfile);
+            log_msg(LOG_INFO, "Could not open PID lock file %s, exiting", pidfile);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        log_msg(LOG_INFO, "No daemonn, no pid/lock File created");
+    }
+
+    /* ------------------------------------------------------------------------------- */
+    /* From here on syslog is written by a low priority thread, the sampling loop     */
+    /* only queues its lines                                                           */
+    /* ------------------------------------------------------------------------------- */
+    if ( !log_start(log_rate) ) {
+        log_msg(LOG_WARNING, "Could not start log thread, writing syslog directly");
+    }
+    atexit(log_stop);
+
+    /* ------------------------------------------------------------------------------- */
+    /* Block the signals before any more threads are started, so they inherit the     */
+    /* mask. In reactor mode they arrive through a signalfd, otherwise the main thread */
+    /* unblocks them once its handler is in place.                                     */
+    /* ------------------------------------------------------------------------------- */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    if ( reactor ) {
+        if ( !reactor_init(&signals) ) {
+            log_msg(LOG_ERR, "Could not set up event loop");
             exit(EXIT_FAILURE);
         }
+        if ( mqtt_async ) {
+            log_msg(LOG_WARNING, "MQTT_ASYNC needs a publisher thread, publishing synchronously in reactor mode");
+        }
     } else {
-        syslog(LOG_INFO, "No daemonn, no pid/lock File created");
+        pthread_sigmask(SIG_BLOCK, &signals, NULL);
     }
 
     /* ------------------------------------------------------------------------------- */
-    /* Setup Wiring PI                                                                 */
+    /* Setup GPIO backend (Wiring PI or simulation)                                    */
     /* ------------------------------------------------------------------------------- */
-    if(wiringPiSetup()==-1) {
-        syslog(LOG_ERR, "Could not setiup wiringPI");
+    if ( !gpio_init(gpio_type, gpio_chip, gpio_sim_fifo) ) {
+        log_msg(LOG_ERR, "Could not setiup GPIO backend");
         exit(EXIT_FAILURE);
     } else {
-        // Set pins sensors are connected to as input pins
-        uint8_t index=0;
-        while ( sensor_list[index].label ) {
-            pinMode(sensor_list[index].pin, INPUT);
-            index++;
+        // Set pins sensors are connected to as input pins, request edge events
+        for ( size_t index=0; index<sensors.count; index++ ) {
+            sensor_t *sensor = &sensors.meta[index];
+
+            gpio_input(sensor->pin);
+            gpio_debounce(sensor->pin, debounce_stable[sensor->pin] * 1000);
+            if ( sensors.poll[index].edge && !gpio_watch(sensor->pin) ) {
+                log_msg(LOG_WARNING, "No edge events for pin %d, polling '%s' instead",
+                        sensor->pin, sensor->label);
+                sensors.poll[index].edge = false;
+            }
+            // the kernel only passes on edges that were stable, the flip limit stays ours
+            if ( sensors.poll[index].edge && gpio_debounced(sensor->pin) ) {
+                debounce_setup(&sensor->debounce, 0, sensor->debounce.max_flips);
+            }
+        }
+        setupBank();
+        applyTolerance();
+        if ( reactor ) {
+            int fds[64];
+            int count = gpio_fds(fds, 64);
+            for ( int i=0; i<count; i++ ) {
+                if ( !reactor_add(fds[i], REACTOR_GPIO, false) ) {
+                    exit(EXIT_FAILURE);
+                }
+            }
         }
     }
 
+    /* ------------------------------------------------------------------------------- */
+    /* DHT11 transactions run on their own thread, wake up when results come in        */
+    /* ------------------------------------------------------------------------------- */
+    bool need_reader = false;
+    for ( size_t index=0; index<sensors.count; index++ ) {
+        need_reader |= (sensors.meta[index].type != DIGITAL);
+    }
+    if ( need_reader && !(dht11_reader_start(dht11_priority, dht11_freshness, dht11_interval) && wakeOn(dht11_result_fd())) ) {
+        log_msg(LOG_ERR, "Could not start DHT11 reader thread");
+        exit(EXIT_FAILURE);
+    }
+
     /* ------------------------------------------------------------------------------- */
     /* get MQTT ID basen on MAC address                                                */
     /* ------------------------------------------------------------------------------- */
     if ( !get_id(id) ) {
-        syslog(LOG_ERR, "Could not read MAC address of interface %s\n", mqtt_interface );
+        log_msg(LOG_ERR, "Could not read MAC address of interface %s\n", mqtt_interface );
         exit(EXIT_FAILURE);
     }
 
+    prepareTopics(id);
+
+    /* ------------------------------------------------------------------------------- */
+    /* open store-and-forward spool                                                    */
+    /* ------------------------------------------------------------------------------- */
+    if ( spool_file ) {
+        if ( !spool_open(spool_file, spool_size, configSignature(), spool_drop_oldest) ) {
+            log_msg(LOG_ERR, "Could not open spool file %s", spool_file);
+            exit(EXIT_FAILURE);
+        }
+        if ( spool_count() ) {
+            log_msg(LOG_INFO, "%u spooled readings to resend", spool_count());
+        }
+    }
+
+    /* ------------------------------------------------------------------------------- */
+    /* local journal of published readings                                             */
+    /* ------------------------------------------------------------------------------- */
+    if ( journal_dir ) {
+        if ( !journal_open(journal_dir, journal_segment*1024, (uint64_t)journal_size*1024) ||
+             !journalSensors() ) {
+            log_msg(LOG_ERR, "Could not open journal in %s", journal_dir);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* ------------------------------------------------------------------------------- */
+    /* last values for local readers, not having them is no reason to stop either      */
+    /* ------------------------------------------------------------------------------- */
+    if ( shared_memory && !(shared_create(shared_memory) && sharedSensors()) ) {
+        log_msg(LOG_WARNING, "No shared memory values at %s", shared_memory);
+        shared_memory = NULL;
+    }
+
+    /* ------------------------------------------------------------------------------- */
+    /* local stats endpoint, not having one is no reason to stop                       */
+    /* ------------------------------------------------------------------------------- */
+    if ( stats_socket && !(stats_listen(stats_socket) && wakeOn(stats_fd())) ) {
+        log_msg(LOG_WARNING, "No stats endpoint at %s", stats_socket);
+    }
+
     /* ------------------------------------------------------------------------------- */
     /* initialize connection to MQTT server                                            */
     /* ------------------------------------------------------------------------------- */
+    mqtt_setup(mqtt_qos, mqtt_inflight, mqtt_async && !reactor, reactor);
     if ( !mqtt_init(mqtt_broker_ip, mqtt_broker_port, mqtt_keepalive)) {
-        syslog(LOG_ERR, "Unable to connect to MQTT broker at %s:%d",
-               mqtt_broker_ip, mqtt_broker_port);
+        log_msg(LOG_ERR, "Unable to connect to MQTT broker at %s:%d",
+                mqtt_broker_ip, mqtt_broker_port);
         exit(EXIT_FAILURE);
     }
 
     /* ------------------------------------------------------------------------------- */
     /* Signals to handle                                                               */
     /* ------------------------------------------------------------------------------- */
-    signal(SIGHUP,  sigendCB);      /* catch hangup signal                             */
-    signal(SIGTERM, sigendCB);      /* catch term signal                               */
-    signal(SIGINT,  sigendCB);      /* catch interrupt signal                          */
+    if ( !reactor ) {
+        signal(SIGHUP,  sigendCB);  /* catch hangup signal                             */
+        signal(SIGTERM, sigendCB);  /* catch term signal                               */
+        signal(SIGINT,  sigendCB);  /* catch interrupt signal                          */
+        pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    }
 
     /* ------------------------------------------------------------------------------- */
     /* now we can do our business                                                      */
     /* ------------------------------------------------------------------------------- */
-    syslog(LOG_INFO, "Startup successfull" );
+    log_msg(LOG_INFO, "Startup successfull" );
     
     uint64_t last_full_report = (uint64_t)0;
+    uint64_t last_stats       = monotonic_timestamp();
+    uint64_t planned_wakeup   = (uint64_t)0;
     bool     force_reading    = true;
-    
-    for ( ;; ) {
-        uint64_t now       = current_timestamp();
-        uint64_t next_time = last_full_report+report_cycle;
-        uint8_t  index     = 0;
+
+    report.connects = mqtt_connects();
+
+    start_time = last_stats;
+    spreadSensors(start_time);
+
+    while ( !exit_pending ) {
+        // SIGHUP, switch to the new configuration between two passes
+        if ( reload_pending ) {
+            reloadConfig(id);
+            planned_wakeup = 0;                     // made for the old schedule
+        }
+
+        uint64_t now       = monotonic_timestamp();
+        uint64_t next_time = last_full_report + report_cycle*1000;
+        sample_stats.wakeups++;
+        if ( shared_memory ) {
+            shared_heartbeat(current_timestamp());
+        }
         
         // time to send a full report?
         if ( next_time <= now ) {
             if (debug) {
-                syslog(LOG_INFO, "Trigger full sensor report");
+                dht11_stats_t dht;
+                dht11_reader_stats(&dht);
+                log_msg(LOG_INFO, "Trigger full sensor report");
+                if ( dht.reads ) {
+                    log_msg(LOG_INFO, "DHT11 reader: %u reads, %u failed (%u%%), %u cached, %u deferred, "
+                            "%u dropped, start delay min/avg/max %llu/%llu/%llu usec, longest read %llu usec",
+                            dht.reads, dht.failures, 100 * dht.failures / dht.reads,
+                            dht.cache_hits, dht.deferred, dht.dropped,
+                            (unsigned long long)dht.delay_min,
+                            (unsigned long long)(dht.delay_sum / dht.reads),
+                            (unsigned long long)dht.delay_max,
+                            (unsigned long long)dht.duration_max);
+                }
+                if ( publish_stats.changes ) {
+                    log_msg(LOG_INFO, "Published %llu changes in %llu messages, %llu bytes "
+                            "(%llu messages, %llu bytes with one message per change)",
+                            (unsigned long long)publish_stats.changes,
+                            (unsigned long long)publish_stats.messages,
+                            (unsigned long long)publish_stats.bytes,
+                            (unsigned long long)publish_stats.changes,
+                            (unsigned long long)publish_stats.sensor_bytes);
+                }
+                if ( sample_stats.samples ) {
+                    log_msg(LOG_INFO, "Sampling: %llu scheduled reads, jitter avg/max %llu/%llu usec, "
+                            "late avg/max %llu/%llu usec, %llu skipped",
+                            (unsigned long long)sample_stats.samples,
+                            (unsigned long long)(sample_stats.jitter_sum / sample_stats.samples),
+                            (unsigned long long)sample_stats.jitter_max,
+                            (unsigned long long)(sample_stats.late_sum / sample_stats.samples),
+                            (unsigned long long)sample_stats.late_max,
+                            (unsigned long long)sample_stats.skipped);
+                }
+                if ( spool_file ) {
+                    log_msg(LOG_INFO, "Spool: %u readings waiting, %u dropped",
+                            spool_count(), spool_dropped());
+                }
+                mqtt_stats_t mqtt;
+                mqtt_stats(&mqtt);
+                log_msg(LOG_INFO, "MQTT: %u published, %u failed, %u queued, %u dropped, "
+                        "queue depth %u (max %u), in flight %u (max %u), window full %u times",
+                        mqtt.published, mqtt.failed, mqtt.queued, mqtt.dropped,
+                        mqtt.depth, mqtt.depth_max, mqtt.inflight, mqtt.inflight_max,
+                        mqtt.window_full);
             }
-            force_reading    = true;
             last_full_report = now;
-            next_time        = now + report_cycle;
+            next_time        = now + report_cycle*1000;
+
+            // the first cycle has nothing to resend, everything was just read
+            report.start  = now;
+            report.next   = force_reading ? sensors.count : 0;
+            report.resend = (report_mode == REPORT_RESEND);
+            if ( journal_dir ) {
+                journal_sync();
+            }
         }
-        
-        // step through sensors an check if their time is up
-        while ( sensor_list[index].label ) {
-            if ((sensor_list[index].next_read <= now) || force_reading) {
-                // time's up, read sensor value!
-                if (force_reading) {
-                    sensor_list[index].value = RESET_VALUE;
-                }
-                readSensor(id, sensor_list[index].pin,
-                               sensor_list[index].label,
-                               sensor_list[index].invert,
-                               sensor_list[index].type,
-                               &(sensor_list[index].value));
-                sensor_list[index].next_read = now + (sensor_list[index].freq);
 
-                if (debug>=2) {
-                    syslog(LOG_INFO, "Sensor %s next read in %llu usec",
-                            sensor_list[index].label,
-                            sensor_list[index].next_read-now);
+        // the broker may have missed changes while it was away, retained values too; the
+        // connect counter also tells about a reconnect while the loop slept
+        if ( mqtt_connected() && mqtt_connects() != report.connects ) {
+            report.connects = mqtt_connects();
+            report.start    = now;
+            report.next     = 0;
+            report.resend   = true;
+        }
+
+        if ( force_reading ) {
+            // first pass, read all sensors and build the schedule
+            full_report = true;
+            sched_clear(&schedule);
+            for ( uint32_t index=0; index<sensors.count; index++ ) {
+                sensors.value[index] = RESET_VALUE;
+                if ( !sensors.meta[index].banked ) {
+                    pollSensor(id, index, now);
                 }
             }
-            if (sensor_list[index].next_read < next_time) {
-                next_time = sensor_list[index].next_read;
+            if ( bank.lines ) {
+                sampleBank(id, now, true);
+            }
+            full_report = false;
+        } else {
+            // take sensors off the schedule as long as their time is up. The kernel may
+            // fire anywhere in the timer slack before the planned wakeup, the reads
+            // planned for it are done now, at most timer_slack (their tolerance) early
+            uint64_t due_by = now;
+            uint32_t index;
+            if ( planned_wakeup > now && now + timer_slack >= planned_wakeup ) {
+                due_by = planned_wakeup;
+            }
+            while ( sched_pop_due(&schedule, due_by, &index) ) {
+                if ( index == BANK_ENTRY ) {
+                    sampleBank(id, due_by, false);
+                } else {
+                    pollSensor(id, index, due_by);
+                }
             }
-            index++;
+        }
+        // latest wakeup that keeps every read within its tolerance, less the timer slack
+        uint64_t wakeup = sched_wakeup(&schedule, (uint64_t)-1);
+        planned_wakeup  = (wakeup != (uint64_t)-1) ? wakeup : 0;
+        if ( wakeup != (uint64_t)-1 && wakeup - timer_slack < next_time ) {
+            next_time = wakeup - timer_slack;
         }
         force_reading = false;
 
+        // unchanged values go out one at a time over the cycle
+        uint64_t next_report = reportSensors(id, now);
+        if ( next_report < next_time ) {
+            next_time = next_report;
+        }
+
+        // changes of this pass go out now, or when the coalescing window closes
+        flushBatch(id, false);
+        if ( batchDeadline() < next_time ) {
+            next_time = batchDeadline();
+        }
+
+        // periodic statistics on the stats topic
+        if ( stats_interval ) {
+            if ( last_stats + stats_interval*1000 <= now ) {
+                publishStats();
+                last_stats = now;
+            }
+            if ( last_stats + stats_interval*1000 < next_time ) {
+                next_time = last_stats + stats_interval*1000;
+            }
+        }
+
+        // resend what piled up while the broker was away
+        uint64_t next_drain = drainSpool(now);
+        if ( next_drain < next_time ) {
+            next_time = next_drain;
+        }
+
+        // readers of the shared values take a missing heartbeat for a crashed daemon
+        if ( shared_memory && now + SHARED_HEARTBEAT*1000ULL < next_time ) {
+            next_time = now + SHARED_HEARTBEAT*1000ULL;
+        }
+
         if (debug>=2) {
-            syslog(LOG_INFO, "sleep for %lld usec", next_time-now);
+            log_msg(LOG_INFO, "sleep for %lld usec", next_time-now);
+        }
+
+        // sleep until the next sensor is due, publishing edge events as they come in
+        if ( reactor ) {
+            waitReactor(id, next_time);
+        } else {
+            gpio_event_t event;
+            int          result = 0;
+            while ( next_time > now && (result = gpio_wait_until(next_time, &event)) == 1 ) {
+                handleEvent(id, &event);
+                flushBatch(id, false);
+                if ( batchDeadline() < next_time ) {
+                    next_time = batchDeadline();
+                }
+                now = monotonic_timestamp();
+            }
+            if ( result == -1 && next_time > now ) {
+                log_msg(LOG_ERR, "Error: waiting for GPIO events failed");
+                usleep(next_time - now);
+            }
+        }
+
+        // answer stats requests
+        serveStats();
+
+        // collect finished DHT11 transactions
+        dht11_result_t reading;
+        while ( dht11_result(&reading) ) {
+            handleResult(id, &reading);
         }
-        usleep((next_time-now)*1000);
+        flushBatch(id, false);
     }
     
     /* ------------------------------------------------------------------------------- */
     /* finish up                                                                       */
     /* ------------------------------------------------------------------------------- */
+    log_msg(LOG_INFO, "Daemon exiting");
     shutdown_daemon();
     exit(EXIT_SUCCESS);
 
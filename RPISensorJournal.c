@@ -0,0 +1,217 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Query the local journal written by rpisensorclient (JOURNAL_DIR):
+ *   rpisensorjournal [-d dir] [-s label] [-f from] [-t to] [-a] [-i]
+ * from/to are seconds since the epoch, negative values count back from now (-f -3600 is
+ * the last hour). Without options all readings are listed by time, one per line:
+ *   <date> <time>.<msecs> <label> <value>
+ * -a prints count, min, max, mean, first and last value per label instead, -i what the
+ * journal holds and how many bytes a reading takes.
+ * ---------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Journal.h"
+
+#define JOURNAL_DIR      "/var/lib/rpisensorclient"
+
+typedef struct {
+    uint64_t  time;                             /* msecs since the epoch               */
+    uint32_t  label;                            /* index in labels[]                   */
+    uint16_t  value;
+} reading_t;
+
+typedef struct {
+    uint64_t  count;
+    uint64_t  sum;
+    uint16_t  min, max, first, last;
+    uint64_t  first_time, last_time;
+} summary_t;
+
+char       *only_label = NULL;
+char       **labels    = NULL;                  /* segments are unmapped after a scan  */
+summary_t  *summaries  = NULL;
+uint32_t   num_labels  = 0;
+reading_t  *readings   = NULL;
+size_t     num_readings = 0, readings_size = 0;
+bool       aggregate   = false;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Index of a label, added on first sight. A journal has a few dozen of them and
+ * consecutive readings mostly share one, so a linear search behind a cache will do.
+ * ---------------------------------------------------------------------------------------
+ */
+uint32_t labelIndex(const char *label) {
+    static uint32_t last = 0;
+
+    if ( last < num_labels && !strcmp(labels[last], label) ) {
+        return last;
+    }
+    for ( last=0; last<num_labels; last++ ) {
+        if ( !strcmp(labels[last], label) ) {
+            return last;
+        }
+    }
+    labels    = realloc(labels, (num_labels+1) * sizeof(char*));
+    summaries = realloc(summaries, (num_labels+1) * sizeof(summary_t));
+    if ( !labels || !summaries || !(labels[num_labels] = strdup(label)) ) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&summaries[num_labels], 0, sizeof(summary_t));
+    return last = num_labels++;
+}
+
+void visit(const char *label, uint64_t time, uint16_t value, void *arg) {
+    uint32_t index;
+
+    if ( only_label && strcmp(label, only_label) ) {
+        return;
+    }
+    index = labelIndex(label);
+
+    if ( aggregate ) {
+        summary_t *summary = &summaries[index];
+
+        if ( summary->count == 0 || value < summary->min ) {
+            summary->min = value;
+        }
+        if ( summary->count == 0 || value > summary->max ) {
+            summary->max = value;
+        }
+        if ( summary->count == 0 || time < summary->first_time ) {
+            summary->first_time = time;
+            summary->first      = value;
+        }
+        if ( summary->count == 0 || time >= summary->last_time ) {
+            summary->last_time = time;
+            summary->last      = value;
+        }
+        summary->count++;
+        summary->sum += value;
+        return;
+    }
+
+    if ( num_readings == readings_size ) {
+        readings_size = readings_size ? readings_size * 2 : 4096;
+        readings = realloc(readings, readings_size * sizeof(reading_t));
+        if ( !readings ) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    readings[num_readings].time  = time;
+    readings[num_readings].label = index;
+    readings[num_readings].value = value;
+    num_readings++;
+}
+
+static int compareTime(const void *a, const void *b) {
+    const reading_t *ra = a, *rb = b;
+
+    if ( ra->time != rb->time ) {
+        return ra->time < rb->time ? -1 : 1;
+    }
+    return (int)ra->label - (int)rb->label;
+}
+
+void printTime(uint64_t msecs) {
+    time_t    secs = msecs / 1000;
+    struct tm tm;
+    char      buffer[32];
+
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime_r(&secs, &tm));
+    printf("%s.%03u", buffer, (unsigned)(msecs % 1000));
+}
+
+uint64_t parseTime(const char *arg) {
+    long long secs = atoll(arg);
+
+    if ( secs < 0 ) {
+        secs += time(NULL);
+    }
+    return secs < 0 ? 0 : (uint64_t)secs * 1000;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * M A I N
+ * ---------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[]) {
+    char            *dir  = JOURNAL_DIR;
+    uint64_t        from  = 0, to = UINT64_MAX;
+    bool            info  = false;
+    journal_stats_t stats;
+    int             opt;
+
+    while ( (opt = getopt(argc, argv, "d:s:f:t:ai")) != -1 ) {
+        switch ( opt ) {
+            case 'd': dir        = optarg;               break;
+            case 's': only_label = optarg;               break;
+            case 'f': from       = parseTime(optarg);    break;
+            case 't': to         = parseTime(optarg) + 999; break;
+            case 'a': aggregate  = true;                 break;
+            case 'i': info       = true;                 break;
+            default:
+                fprintf(stderr, "Usage: %s [-d dir] [-s label] [-f from] [-t to] [-a] [-i]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if ( journal_scan(dir, from, to, visit, NULL, &stats) == -1 ) {
+        exit(EXIT_FAILURE);
+    }
+
+    if ( info ) {
+        printf("%u segments, %u blocks, %llu readings, %llu bytes, %.2f bytes per reading, %u corrupt\n",
+               stats.segments, stats.blocks, (unsigned long long)stats.readings,
+               (unsigned long long)stats.bytes,
+               stats.readings ? (double)stats.bytes / stats.readings : 0.0, stats.corrupt);
+    } else if ( aggregate ) {
+        printf("%-20s %10s %6s %6s %9s %6s %6s\n", "label", "count", "min", "max", "mean", "first", "last");
+        for ( uint32_t index=0; index<num_labels; index++ ) {
+            summary_t *summary = &summaries[index];
+
+            printf("%-20s %10llu %6u %6u %9.3f %6u %6u\n", labels[index],
+                   (unsigned long long)summary->count, summary->min, summary->max,
+                   (double)summary->sum / summary->count, summary->first, summary->last);
+        }
+    } else {
+        qsort(readings, num_readings, sizeof(reading_t), compareTime);
+        for ( size_t n=0; n<num_readings; n++ ) {
+            printTime(readings[n].time);
+            printf(" %s %u\n", labels[readings[n].label], readings[n].value);
+        }
+    }
+    return EXIT_SUCCESS;
+}
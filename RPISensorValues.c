@@ -0,0 +1,208 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Current sensor values from the shared memory segment of rpisensorclient (SHARED_MEMORY):
+ *   rpisensorvalues [-n name] [-s label] [-w msecs] [-i] [-b]
+ * Without options every sensor is listed once, one per line:
+ *   <label> <pin> <value> <flags> <date> <time>.<msecs>
+ * flags are F (full report) and D (debounced), the time is when the value was published.
+ * -s prints the value of one sensor only, -w repeats every msecs (attaching again when
+ * the daemon restarts or its heartbeat stops), -i shows the segment header and -b
+ * measures what one read costs.
+ * ---------------------------------------------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Shared.h"
+#include "Payload.h"
+
+#define SHARED_MEMORY    "/rpisensorclient"
+
+void printTime(uint64_t msecs) {
+    time_t    secs = msecs / 1000;
+    struct tm tm;
+    char      buffer[32];
+
+    if ( msecs == 0 ) {
+        printf("never");
+        return;
+    }
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", localtime_r(&secs, &tm));
+    printf("%s.%03u", buffer, (unsigned)(msecs % 1000));
+}
+
+uint64_t milliseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+}
+
+uint64_t nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * One pass over the segment, false if it was closed meanwhile
+ * ---------------------------------------------------------------------------------------
+ */
+bool printValues(const shared_reader_t *reader, const char *label) {
+    shared_value_t value;
+    uint32_t       count = shared_count(reader);
+
+    if ( label ) {
+        int index = shared_find(reader, label);
+
+        if ( index == -1 || !shared_get(reader, index, &value) ) {
+            return !shared_closed(reader);
+        }
+        printf("%u\n", value.value);
+        return true;
+    }
+    for ( uint32_t index=0; index<count; index++ ) {
+        if ( !shared_get(reader, index, &value) ) {
+            if ( shared_closed(reader) ) {
+                return false;
+            }
+            continue;                       /* left halfway by a dead writer           */
+        }
+        printf("%-20s %3u %6u %c%c ", value.label, value.pin, value.value,
+               (value.quality & PAYLOAD_FULL_REPORT) ? 'F' : '-',
+               (value.quality & PAYLOAD_DEBOUNCED)   ? 'D' : '-');
+        printTime(value.time);
+        printf("\n");
+    }
+    return true;
+}
+
+void printInfo(const shared_reader_t *reader) {
+    const shared_header_t *header = reader->header;
+
+    printf("pid %d, %u sensors (room for %u), table generation %u, started ",
+           header->pid, shared_count(reader), header->capacity, header->generation);
+    printTime(header->started);
+    printf(", last loop ");
+    printTime(shared_heartbeat_time(reader));
+    printf("%s\n", shared_closed(reader) ? ", closed" : "");
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Read every sensor over and over for a second
+ * ---------------------------------------------------------------------------------------
+ */
+void benchmark(const shared_reader_t *reader) {
+    shared_value_t value;
+    uint32_t       count = shared_count(reader);
+    uint64_t       reads = 0, start = nanoseconds(), elapsed;
+
+    if ( count == 0 ) {
+        return;
+    }
+    do {
+        for ( int round=0; round<1000; round++ ) {
+            shared_get(reader, reads++ % count, &value);
+        }
+        elapsed = nanoseconds() - start;
+    } while ( elapsed < 1000000000LL );
+    printf("%llu reads in %llu msecs, %.1f nsecs per read\n", (unsigned long long)reads,
+           (unsigned long long)elapsed / 1000000, (double)elapsed / reads);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * M A I N
+ * ---------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[]) {
+    char            *name  = SHARED_MEMORY;
+    char            *label = NULL;
+    uint32_t        watch  = 0;
+    bool            info   = false, bench = false;
+    shared_reader_t reader;
+    bool            stopped = false;
+    int             opt;
+
+    while ( (opt = getopt(argc, argv, "n:s:w:ib")) != -1 ) {
+        switch ( opt ) {
+            case 'n': name  = optarg;               break;
+            case 's': label = optarg;               break;
+            case 'w': watch = atoi(optarg);         break;
+            case 'i': info  = true;                 break;
+            case 'b': bench = true;                 break;
+            default:
+                fprintf(stderr, "Usage: %s [-n name] [-s label] [-w msecs] [-i] [-b]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if ( !shared_attach(&reader, name) ) {
+        fprintf(stderr, "Error: no sensor values at %s\n", name);
+        exit(EXIT_FAILURE);
+    }
+    if ( info ) {
+        printInfo(&reader);
+    }
+    if ( bench ) {
+        benchmark(&reader);
+        return EXIT_SUCCESS;
+    }
+
+    for ( ;; ) {
+        if ( !printValues(&reader, label) ) {
+            shared_detach(&reader);
+            if ( !watch ) {
+                fprintf(stderr, "Error: sensor values at %s went away\n", name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if ( !watch ) {
+            break;
+        }
+        fflush(stdout);
+        usleep(watch * 1000);
+        // a crashed daemon leaves its segment open, but stops beating
+        while ( !shared_alive(&reader, milliseconds()) ) {
+            if ( !shared_closed(&reader) && !stopped ) {
+                fprintf(stderr, "Error: no heartbeat from the daemon at %s, attaching again\n", name);
+                stopped = true;
+            }
+            shared_detach(&reader);
+            if ( !shared_attach(&reader, name) || !shared_alive(&reader, milliseconds()) ) {
+                usleep(watch * 1000);
+            }
+        }
+        stopped = false;
+    }
+    shared_detach(&reader);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "Reactor.h"
+
+#define REACTOR_EVENTS  32
+
+static int epoll_fd  = -1;
+static int timer_fd  = -1;
+static int signal_fd = -1;
+
+/*
+ * source and fd travel together in the epoll user data
+ */
+static uint64_t pack( reactor_source_t source, int fd ) {
+    return (uint64_t)source << 32 | (uint32_t)fd;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Create the epoll instance with its timer and signal fds. The signals have to be blocked
+ * in every thread for the signalfd to see them, so call this before starting any.
+ * ---------------------------------------------------------------------------------------
+ */
+bool reactor_init( const sigset_t *signals ) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if ( epoll_fd == -1 ) {
+        fprintf(stderr, "Error: epoll_create1 [%s]\n", strerror(errno));
+        return false;
+    }
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if ( timer_fd == -1 || !reactor_add(timer_fd, REACTOR_TIMER, false) ) {
+        fprintf(stderr, "Error: timerfd [%s]\n", strerror(errno));
+        reactor_end();
+        return false;
+    }
+    if ( signals ) {
+        sigprocmask(SIG_BLOCK, signals, NULL);
+        signal_fd = signalfd(-1, signals, SFD_NONBLOCK|SFD_CLOEXEC);
+        if ( signal_fd == -1 || !reactor_add(signal_fd, REACTOR_SIGNAL, false) ) {
+            fprintf(stderr, "Error: signalfd [%s]\n", strerror(errno));
+            reactor_end();
+            return false;
+        }
+    }
+    return true;
+}
+
+void reactor_end( void ) {
+    if ( signal_fd != -1 ) {
+        close(signal_fd);
+        signal_fd = -1;
+    }
+    if ( timer_fd != -1 ) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+    if ( epoll_fd != -1 ) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+bool reactor_add( int fd, reactor_source_t source, bool writable ) {
+    struct epoll_event ev;
+
+    ev.events   = EPOLLIN | (writable ? EPOLLOUT : 0);
+    ev.data.u64 = pack(source, fd);
+    if ( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1 ) {
+        fprintf(stderr, "Error: epoll_ctl add fd %d [%s]\n", fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool reactor_modify( int fd, reactor_source_t source, bool writable ) {
+    struct epoll_event ev;
+
+    ev.events   = EPOLLIN | (writable ? EPOLLOUT : 0);
+    ev.data.u64 = pack(source, fd);
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void reactor_remove( int fd ) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);           /* fails if already closed */
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Fire the timer at 'deadline' (usec, CLOCK_MONOTONIC), an absolute time does not drift
+ * by however long it took to get here. 0 disarms it.
+ * ---------------------------------------------------------------------------------------
+ */
+bool reactor_arm( uint64_t deadline ) {
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = deadline / 1000000;
+    its.it_value.tv_nsec = deadline % 1000000 * 1000;
+    return timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Block until something happens, returns the number of events stored or -1 on error.
+ * An expired timer is acknowledged here.
+ * ---------------------------------------------------------------------------------------
+ */
+int reactor_wait( reactor_event_t *events, int max ) {
+    struct epoll_event ev[REACTOR_EVENTS];
+    int                count;
+
+    if ( max > REACTOR_EVENTS ) {
+        max = REACTOR_EVENTS;
+    }
+    count = epoll_wait(epoll_fd, ev, max, -1);
+    if ( count == -1 ) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for ( int i=0; i<count; i++ ) {
+        events[i].source   = ev[i].data.u64 >> 32;
+        events[i].fd       = (int)(uint32_t)ev[i].data.u64;
+        events[i].readable = ev[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR);
+        events[i].writable = ev[i].events & EPOLLOUT;
+        if ( events[i].source == REACTOR_TIMER ) {
+            uint64_t expirations;
+            if ( read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations) ) {
+                events[i].readable = false;                 /* re-armed meanwhile      */
+            }
+        }
+    }
+    return count;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Next pending signal from the signalfd, 0 if there is none
+ * ---------------------------------------------------------------------------------------
+ */
+int reactor_signal( void ) {
+    struct signalfd_siginfo info;
+
+    if ( signal_fd == -1 || read(signal_fd, &info, sizeof(info)) != sizeof(info) ) {
+        return 0;
+    }
+    return info.ssi_signo;
+}
@@ -0,0 +1,57 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Reactor_h
+#define Reactor_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Single threaded event loop: one epoll instance watching the MQTT socket, GPIO line
+ * event fds, wake fds (DHT11 results, stats socket), a timerfd for the next deadline and
+ * a signalfd, so the daemon only wakes up when there is something to do.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef enum { REACTOR_TIMER, REACTOR_SIGNAL, REACTOR_MQTT, REACTOR_GPIO, REACTOR_WAKE } reactor_source_t;
+
+typedef struct {
+    reactor_source_t  source;
+    int               fd;
+    bool              readable;
+    bool              writable;
+} reactor_event_t;
+
+bool reactor_init( const sigset_t *signals );
+void reactor_end( void );
+bool reactor_add( int fd, reactor_source_t source, bool writable );
+bool reactor_modify( int fd, reactor_source_t source, bool writable );
+void reactor_remove( int fd );
+bool reactor_arm( uint64_t deadline );
+int  reactor_wait( reactor_event_t *events, int max );
+int  reactor_signal( void );
+
+#endif /* Reactor_h */
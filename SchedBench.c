@@ -0,0 +1,174 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Scheduler benchmark: the cost of one pass of the main loop finding and rescheduling the
+ * due sensors, with a linear scan over the due times as before the deadline heap against
+ * sched_pop_due()/sched_push() of Scheduler.c. Sensors are read every 10 msecs to 10 secs,
+ * the clock moves on 10 msecs per tick. Reported per sensor count, in nsecs:
+ *   tick     per pass, find the due sensors, give them their next due time and find the
+ *            time to sleep until
+ *   read     the same per sensor read, the part of a pass that grows with the due sensors
+ * ---------------------------------------------------------------------------------------
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "Scheduler.h"
+
+#define BENCH_WORK   (16*1024*1024)             /* sensor visits per measurement       */
+#define BENCH_TICK   10000                      /* usec between passes                 */
+
+static const uint64_t periods[] = { 10000, 100000, 1000000, 10000000 };
+
+volatile uint64_t sink;                         /* keeps results from being optimized  */
+
+uint64_t bench_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * One pass, once for each way of keeping the due times. Return the number of reads.
+ * ---------------------------------------------------------------------------------------
+ */
+uint64_t tickScan(uint64_t *next_read, uint64_t *period, size_t count, uint64_t now) {
+    uint64_t next = (uint64_t)-1, reads = 0;
+
+    for ( size_t index=0; index<count; index++ ) {
+        if ( next_read[index] <= now ) {
+            next_read[index] += period[index];
+            reads++;
+        }
+        if ( next_read[index] < next ) {
+            next = next_read[index];
+        }
+    }
+    sink += next;
+    return reads;
+}
+
+uint64_t tickHeap(scheduler_t *sched, uint64_t *next_read, uint64_t *period, uint64_t now) {
+    uint64_t reads = 0;
+    uint32_t index;
+
+    while ( sched_pop_due(sched, now, &index) ) {
+        next_read[index] += period[index];
+        sched_push(sched, next_read[index], index);
+        reads++;
+    }
+    sink += sched_next(sched, now + BENCH_TICK);
+    return reads;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * 'count' sensors, periods mixed, first due times spread over their period
+ * ---------------------------------------------------------------------------------------
+ */
+void fillSensors(uint64_t *next_read, uint64_t *period, size_t count) {
+    for ( size_t index=0; index<count; index++ ) {
+        period[index]    = periods[index % (sizeof(periods)/sizeof(periods[0]))];
+        next_read[index] = (index * 7919 * BENCH_TICK) % period[index];
+    }
+}
+
+void runBench(size_t count) {
+    uint64_t    *next_read = calloc(count, sizeof(uint64_t));
+    uint64_t    *period    = calloc(count, sizeof(uint64_t));
+    scheduler_t sched;
+    size_t      ticks      = BENCH_WORK / count;
+    uint64_t    reads[2]   = { 0, 0 };
+    double      nsecs[2];
+    uint64_t    start;
+
+    if ( ticks < 1024 ) {
+        ticks = 1024;
+    }
+    if ( !next_read || !period || !sched_init(&sched, count) ) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fillSensors(next_read, period, count);
+    start = bench_timestamp();
+    for ( size_t tick=0; tick<ticks; tick++ ) {
+        reads[0] += tickScan(next_read, period, count, tick * BENCH_TICK);
+    }
+    nsecs[0] = (double)(bench_timestamp() - start);
+
+    fillSensors(next_read, period, count);
+    for ( size_t index=0; index<count; index++ ) {
+        sched_push(&sched, next_read[index], index);
+    }
+    start = bench_timestamp();
+    for ( size_t tick=0; tick<ticks; tick++ ) {
+        reads[1] += tickHeap(&sched, next_read, period, tick * BENCH_TICK);
+    }
+    nsecs[1] = (double)(bench_timestamp() - start);
+
+    printf("%7zu %9.1f %11.0f %11.0f %9.1f %9.1f\n", count,
+           (double)reads[1] / ticks, nsecs[0] / ticks, nsecs[1] / ticks,
+           reads[0] ? nsecs[0] / reads[0] : 0.0, reads[1] ? nsecs[1] / reads[1] : 0.0);
+    fflush(stdout);
+    free(next_read);
+    free(period);
+    sched_free(&sched);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * M A I N
+ * ---------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[]) {
+    size_t counts[32] = { 32, 1024, 65536 };
+    int    num_counts = 0;
+
+    for ( int i=1; i<argc && num_counts<32; i++ ) {
+        counts[num_counts++] = strtoul(argv[i], NULL, 10);
+    }
+    if ( num_counts == 0 ) {
+        num_counts = 3;
+    }
+
+    printf("Scheduler, one pass every %d msecs, sensors read every 10 msecs to 10 secs\n",
+           BENCH_TICK / 1000);
+    printf("%7s %9s %11s %11s %9s %9s\n", "", "", "tick", "", "read", "");
+    printf("%7s %9s %11s %11s %9s %9s\n", "sensors", "due", "scan", "heap", "scan", "heap");
+    printf("%7s %9s %11s %11s %9s %9s\n", "", "per tick", "ns/tick", "ns/tick", "ns/read", "ns/read");
+
+    for ( int i=0; i<num_counts; i++ ) {
+        if ( counts[i] ) {
+            runBench(counts[i]);
+        }
+    }
+    return 0;
+}
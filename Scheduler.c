@@ -0,0 +1,158 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include "Scheduler.h"
+
+bool sched_init( scheduler_t *sched, size_t size ) {
+    sched->count = 0;
+    sched->size  = size ? size : 1;
+    sched->heap  = malloc(sched->size * sizeof(sched_entry_t));
+    if ( !sched->heap ) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        sched->size = 0;
+        return false;
+    }
+    return true;
+}
+
+void sched_free( scheduler_t *sched ) {
+    free(sched->heap);
+    sched->heap  = NULL;
+    sched->count = 0;
+    sched->size  = 0;
+}
+
+void sched_clear( scheduler_t *sched ) {
+    sched->count = 0;
+}
+
+bool sched_push( scheduler_t *sched, uint64_t deadline, uint32_t index ) {
+    return sched_push_slack(sched, deadline, 0, index);
+}
+
+bool sched_push_slack( scheduler_t *sched, uint64_t deadline, uint32_t slack, uint32_t index ) {
+    size_t pos;
+
+    if ( sched->count == sched->size ) {
+        sched_entry_t *heap = realloc(sched->heap, 2 * sched->size * sizeof(sched_entry_t));
+        if ( !heap ) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return false;
+        }
+        sched->heap  = heap;
+        sched->size *= 2;
+    }
+
+    // sift up
+    pos = sched->count++;
+    while ( pos > 0 ) {
+        size_t parent = (pos - 1) / 2;
+        if ( sched->heap[parent].deadline <= deadline ) {
+            break;
+        }
+        sched->heap[pos] = sched->heap[parent];
+        pos = parent;
+    }
+    sched->heap[pos].deadline = deadline;
+    sched->heap[pos].index    = index;
+    sched->heap[pos].slack    = slack;
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Take the earliest entry off the heap if it is due at 'now'
+ * ---------------------------------------------------------------------------------------
+ */
+bool sched_pop_due( scheduler_t *sched, uint64_t now, uint32_t *index ) {
+    sched_entry_t last;
+    size_t pos = 0;
+
+    if ( sched->count == 0 || sched->heap[0].deadline > now ) {
+        return false;
+    }
+    *index = sched->heap[0].index;
+
+    // move the last entry to the top and sift it down
+    last = sched->heap[--sched->count];
+    for ( ;; ) {
+        size_t child = 2 * pos + 1;
+        if ( child >= sched->count ) {
+            break;
+        }
+        if ( child + 1 < sched->count && sched->heap[child+1].deadline < sched->heap[child].deadline ) {
+            child++;
+        }
+        if ( last.deadline <= sched->heap[child].deadline ) {
+            break;
+        }
+        sched->heap[pos] = sched->heap[child];
+        pos = child;
+    }
+    if ( sched->count ) {
+        sched->heap[pos] = last;
+    }
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Earliest deadline, 'fallback' if nothing is scheduled
+ * ---------------------------------------------------------------------------------------
+ */
+uint64_t sched_next( scheduler_t *sched, uint64_t fallback ) {
+    if ( sched->count == 0 ) {
+        return fallback;
+    }
+    return sched->heap[0].deadline;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Latest time at which no entry is later than its slack allows, 'fallback' if nothing is
+ * scheduled. Only entries with a deadline before that time can lower it, and children
+ * are never due before their parent, so the search stops at the first entry beyond it:
+ * the cost is the number of entries the wakeup serves.
+ * ---------------------------------------------------------------------------------------
+ */
+static void wakeup_limit( const scheduler_t *sched, size_t pos, uint64_t *wakeup ) {
+    while ( pos < sched->count && sched->heap[pos].deadline <= *wakeup ) {
+        uint64_t limit = sched->heap[pos].deadline + sched->heap[pos].slack;
+
+        if ( limit < *wakeup ) {
+            *wakeup = limit;
+        }
+        wakeup_limit(sched, 2 * pos + 2, wakeup);
+        pos = 2 * pos + 1;
+    }
+}
+
+uint64_t sched_wakeup( scheduler_t *sched, uint64_t fallback ) {
+    uint64_t wakeup;
+
+    if ( sched->count == 0 ) {
+        return fallback;
+    }
+    wakeup = sched->heap[0].deadline + sched->heap[0].slack;
+    wakeup_limit(sched, 0, &wakeup);
+    return wakeup;
+}
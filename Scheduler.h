@@ -0,0 +1,61 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Scheduler_h
+#define Scheduler_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Deadline scheduler, a binary min-heap of (deadline, sensor index) pairs. Finding the
+ * next due sensor is O(1), taking it out and putting it back is O(log n).
+ * An entry may come with slack, how long after its deadline it still is on time.
+ * sched_wakeup() is the latest time that keeps every entry on time, waking up then
+ * serves all entries due by then at once instead of one wakeup per deadline.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint64_t  deadline;
+    uint32_t  index;
+    uint32_t  slack;                            /* usec the entry may run late         */
+} sched_entry_t;
+
+typedef struct {
+    sched_entry_t *heap;
+    size_t        count;
+    size_t        size;
+} scheduler_t;
+
+bool     sched_init( scheduler_t *sched, size_t size );
+void     sched_free( scheduler_t *sched );
+void     sched_clear( scheduler_t *sched );
+bool     sched_push( scheduler_t *sched, uint64_t deadline, uint32_t index );
+bool     sched_push_slack( scheduler_t *sched, uint64_t deadline, uint32_t slack, uint32_t index );
+bool     sched_pop_due( scheduler_t *sched, uint64_t now, uint32_t *index );
+uint64_t sched_next( scheduler_t *sched, uint64_t fallback );
+uint64_t sched_wakeup( scheduler_t *sched, uint64_t fallback );
+
+#endif /* Scheduler_h */
@@ -0,0 +1,119 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <string.h>
+
+#include "Sensors.h"
+
+void sensors_init( sensor_table_t *table ) {
+    memset(table, 0, sizeof(*table));
+    for ( int pin=0; pin<SENSOR_PINS; pin++ ) {
+        table->pin_first[pin] = SENSOR_NONE;
+    }
+}
+
+/*
+ * the strings in sensor_t belong to the caller
+ */
+void sensors_free( sensor_table_t *table ) {
+    free(table->next_read);
+    free(table->last_sample);
+    free(table->value);
+    free(table->batched);
+    free(table->poll);
+    free(table->meta);
+    free(table->pin_next);
+    sensors_init(table);
+}
+
+/*
+ * grow one array to 'size' entries, keeps the old one if there is not enough memory
+ */
+static bool grow( void **array, size_t size, size_t entry ) {
+    void *grown = realloc(*array, size * entry);
+
+    if ( !grown ) {
+        return false;
+    }
+    *array = grown;
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Append a sensor, all fields zero, its polling parameters in poll[count-1]. The arrays
+ * double when full, so a pointer returned earlier may be stale after the next call.
+ * Returns NULL if out of memory.
+ * ---------------------------------------------------------------------------------------
+ */
+sensor_t *sensors_add( sensor_table_t *table ) {
+    size_t index = table->count;
+
+    if ( table->count == table->size ) {
+        size_t size = table->size ? 2*table->size : 16;
+
+        if ( !grow((void**)&table->next_read,   size, sizeof(uint64_t)) ||
+             !grow((void**)&table->last_sample, size, sizeof(uint64_t)) ||
+             !grow((void**)&table->value,       size, sizeof(uint16_t)) ||
+             !grow((void**)&table->batched,     size, sizeof(bool))     ||
+             !grow((void**)&table->poll,        size, sizeof(sensor_poll_t)) ||
+             !grow((void**)&table->meta,        size, sizeof(sensor_t)) ||
+             !grow((void**)&table->pin_next,    size, sizeof(uint32_t)) ) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return NULL;
+        }
+        table->size = size;
+    }
+    table->next_read[index]   = 0;
+    table->last_sample[index] = 0;
+    table->value[index]       = 0;
+    table->batched[index]     = false;
+    table->pin_next[index]    = SENSOR_NONE;
+    memset(&table->poll[index], 0, sizeof(sensor_poll_t));
+    memset(&table->meta[index], 0, sizeof(sensor_t));
+    table->count++;
+    return &table->meta[index];
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Chain the sensors of each pin in table order, call once the table is complete
+ * ---------------------------------------------------------------------------------------
+ */
+void sensors_compile( sensor_table_t *table ) {
+    uint32_t last[SENSOR_PINS];
+
+    for ( int pin=0; pin<SENSOR_PINS; pin++ ) {
+        table->pin_first[pin] = SENSOR_NONE;
+    }
+    for ( size_t index=0; index<table->count; index++ ) {
+        uint8_t pin = table->meta[index].pin;
+
+        table->pin_next[index] = SENSOR_NONE;
+        if ( table->pin_first[pin] == SENSOR_NONE ) {
+            table->pin_first[pin] = index;
+        } else {
+            table->pin_next[last[pin]] = index;
+        }
+        last[pin] = index;
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Sensors_h
+#define Sensors_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Debounce.h"
+#include "Aggregate.h"
+
+#define SENSOR_NONE  UINT32_MAX
+#define SENSOR_PINS  256
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Sensor table, split by how often fields are touched. What every scheduler pass reads
+ * or writes (due times, last values, the polling parameters) sits in packed arrays
+ * indexed by sensor, everything else (label, topics, type, statistics) in sensor_t,
+ * which is only looked at when a sensor is actually read or published. Sensors on the
+ * same pin are chained, so edge events and DHT11 results find theirs without scanning
+ * the table.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef enum { DIGITAL, DHT11_TMP, DHT11_HMD } sensorType_t;
+
+typedef struct {
+    uint32_t      freq;                         /* msecs                               */
+    uint32_t      freq_max;                     /* msecs, adaptive polling, 0 = fixed  */
+    uint32_t      period;                       /* msecs, current interval             */
+    uint32_t      tolerance;                    /* usec a read may be late             */
+    bool          edge;
+} sensor_poll_t;
+
+typedef struct {
+    char          *label;
+    char          *topic;                       /* <label>/<prefix>-<id>/<pin>         */
+    size_t        topic_length;
+    char          *json;                        /* {"<label>":"                        */
+    size_t        json_length;
+    uint32_t      reads;
+    uint32_t      read_max;                     /* usec, longest read                  */
+    uint32_t      late_max;                     /* usec, latest scheduled read         */
+    sensorType_t  type;
+    uint8_t       pin;
+    bool          invert;
+    bool          banked;                       /* read with the other digital lines   */
+    debounce_t    debounce;
+    aggregate_t   aggregate;                    /* window summary instead of changes   */
+    uint64_t      recheck;                      /* usec, pending change on the schedule */
+    uint64_t      changed;                      /* usec, value last published          */
+    uint8_t       quality;                      /* PAYLOAD_* flags of that value       */
+    uint16_t      polled;                       /* value at the last adaptive read     */
+    int32_t       tolerance;                    /* msecs, own lateness, -1 = the pin's */
+} sensor_t;
+
+typedef struct {
+    uint64_t      *next_read;                   /* usec, CLOCK_MONOTONIC               */
+    uint64_t      *last_sample;                 /* usec, CLOCK_MONOTONIC               */
+    uint16_t      *value;
+    bool          *batched;
+    sensor_poll_t *poll;                        /* read by every poll                  */
+    sensor_t      *meta;
+    uint32_t      *pin_next;                    /* next sensor on the same pin         */
+    uint32_t      pin_first[SENSOR_PINS];       /* first sensor on each pin            */
+    size_t        count;
+    size_t        size;
+} sensor_table_t;
+
+void     sensors_init( sensor_table_t *table );
+void     sensors_free( sensor_table_t *table );
+sensor_t *sensors_add( sensor_table_t *table );
+void     sensors_compile( sensor_table_t *table );
+
+#endif /* Sensors_h */
@@ -0,0 +1,337 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "Shared.h"
+
+#define SHARED_MIN       64                     /* entries at least                    */
+#define SHARED_SPINS     64                     /* retries before yielding to a writer */
+#define SHARED_RETRIES   10000                  /* ... and before giving up on it      */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Daemon side: one segment, sized for twice the sensors it was created for so reloads
+ * adding a few sensors keep it
+ * ---------------------------------------------------------------------------------------
+ */
+static char             *shared_name = NULL;
+static shared_header_t  *header      = NULL;
+static shared_entry_t   *entries     = NULL;
+static size_t           mapped       = 0;
+
+static size_t shared_size( uint32_t capacity ) {
+    return sizeof(shared_header_t) + (size_t)capacity * sizeof(shared_entry_t);
+}
+
+static void shared_unmap( void ) {
+    if ( header ) {
+        __atomic_store_n(&header->closed, 1, __ATOMIC_RELEASE);
+        munmap(header, mapped);
+        shm_unlink(shared_name);
+        header  = NULL;
+        entries = NULL;
+        mapped  = 0;
+    }
+}
+
+static bool shared_map( uint32_t capacity ) {
+    size_t size = shared_size(capacity);
+    void   *map;
+    int    fd;
+
+    // whatever a crashed daemon left behind is replaced, its readers see no heartbeat
+    shm_unlink(shared_name);
+    fd = shm_open(shared_name, O_RDWR|O_CREAT|O_EXCL, 0644);
+    if ( fd == -1 ) {
+        fprintf(stderr, "Error: shm_open %s [%s]\n", shared_name, strerror(errno));
+        return false;
+    }
+    if ( ftruncate(fd, size) == -1 ) {
+        fprintf(stderr, "Error: ftruncate %s [%s]\n", shared_name, strerror(errno));
+        close(fd);
+        shm_unlink(shared_name);
+        return false;
+    }
+    map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ) {
+        fprintf(stderr, "Error: mmap %s [%s]\n", shared_name, strerror(errno));
+        shm_unlink(shared_name);
+        return false;
+    }
+
+    header  = map;
+    entries = (shared_entry_t*)(header + 1);
+    mapped  = size;
+    header->version    = SHARED_VERSION;
+    header->entry_size = sizeof(shared_entry_t);
+    header->capacity   = capacity;
+    header->pid        = getpid();
+    __atomic_store_n(&header->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Remember the name, the segment is created with the first sensor table
+ * ---------------------------------------------------------------------------------------
+ */
+bool shared_create( const char *name ) {
+    if ( name[0] != '/' || strchr(name+1, '/') ) {
+        fprintf(stderr, "Error: shared memory name must be /<name>, not %s\n", name);
+        return false;
+    }
+    free(shared_name);
+    shared_name = strdup(name);
+    return shared_name != NULL;
+}
+
+void shared_close( void ) {
+    shared_unmap();
+    free(shared_name);
+    shared_name = NULL;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * New sensor table with the values to start from. Readers retry while it is written,
+ * a table that does not fit any more gets a new segment.
+ * ---------------------------------------------------------------------------------------
+ */
+bool shared_sensors( const shared_value_t *values, uint32_t count ) {
+    uint32_t seq, generation = 0;
+    uint64_t started = 0;
+
+    if ( !shared_name ) {
+        return false;
+    }
+    if ( header && count > header->capacity ) {
+        generation = header->generation;
+        started    = header->started;
+        shared_unmap();
+    }
+    if ( !header && !shared_map(count*2 > SHARED_MIN ? count*2 : SHARED_MIN) ) {
+        return false;
+    }
+    if ( started ) {
+        header->generation = generation;
+        header->started    = started;
+    }
+
+    seq = header->seq;
+    __atomic_store_n(&header->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for ( uint32_t index=0; index<count; index++ ) {
+        shared_entry_t *entry = &entries[index];
+
+        __atomic_store_n(&entry->value,   values[index].value,   __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->quality, values[index].quality, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->pin,     values[index].pin,     __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->time,    values[index].time,    __ATOMIC_RELAXED);
+        strncpy(entry->label, values[index].label, SHARED_LABEL-1);
+        entry->label[SHARED_LABEL-1] = '\0';
+    }
+    __atomic_store_n(&header->count, count, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->generation, header->generation + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->seq, seq + 2, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * A published value, a handful of stores and no system call
+ * ---------------------------------------------------------------------------------------
+ */
+void shared_update( uint32_t index, uint16_t value, uint8_t quality, uint64_t time ) {
+    shared_entry_t *entry;
+    uint32_t       seq;
+
+    if ( !header || index >= header->count ) {
+        return;
+    }
+    entry = &entries[index];
+    seq   = entry->seq;
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&entry->value,   value,   __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->quality, quality, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->time,    time,    __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void shared_heartbeat( uint64_t time ) {
+    if ( header ) {
+        if ( header->started == 0 ) {
+            header->started = time;
+        }
+        __atomic_store_n(&header->heartbeat, time, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Reader side
+ * ---------------------------------------------------------------------------------------
+ */
+bool shared_attach( shared_reader_t *reader, const char *name ) {
+    const shared_header_t *map;
+    struct stat           st;
+    int                   fd;
+
+    memset(reader, 0, sizeof(shared_reader_t));
+    fd = shm_open(name, O_RDONLY, 0);
+    if ( fd == -1 ) {
+        return false;
+    }
+    if ( fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(shared_header_t) ) {
+        close(fd);
+        return false;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( map == MAP_FAILED ) {
+        return false;
+    }
+    if ( __atomic_load_n(&map->magic, __ATOMIC_ACQUIRE) != SHARED_MAGIC ||
+         map->version != SHARED_VERSION || map->entry_size != sizeof(shared_entry_t) ||
+         shared_size(map->capacity) > (size_t)st.st_size ) {
+        munmap((void*)map, st.st_size);
+        errno = EPROTO;
+        return false;
+    }
+    reader->header   = map;
+    reader->entries  = (const shared_entry_t*)(map + 1);
+    reader->capacity = map->capacity;
+    reader->size     = st.st_size;
+    return true;
+}
+
+void shared_detach( shared_reader_t *reader ) {
+    if ( reader->header ) {
+        munmap((void*)reader->header, reader->size);
+    }
+    memset(reader, 0, sizeof(shared_reader_t));
+}
+
+bool shared_closed( const shared_reader_t *reader ) {
+    return !reader->header || __atomic_load_n(&reader->header->closed, __ATOMIC_ACQUIRE);
+}
+
+uint32_t shared_count( const shared_reader_t *reader ) {
+    uint32_t count = reader->header ? __atomic_load_n(&reader->header->count, __ATOMIC_ACQUIRE) : 0;
+
+    return count < reader->capacity ? count : reader->capacity;
+}
+
+uint64_t shared_heartbeat_time( const shared_reader_t *reader ) {
+    return reader->header ? __atomic_load_n(&reader->header->heartbeat, __ATOMIC_RELAXED) : 0;
+}
+
+/* now in msecs since the epoch, a daemon still starting up has no heartbeat yet            */
+bool shared_alive( const shared_reader_t *reader, uint64_t now ) {
+    uint64_t heartbeat = shared_heartbeat_time(reader);
+
+    return !shared_closed(reader) &&
+           (heartbeat == 0 || heartbeat + SHARED_STALE * SHARED_HEARTBEAT >= now);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copy one entry: wait out a table change, then retry the entry until its sequence was
+ * even and the same before and after the copy. A writer that died halfway leaves the
+ * sequence odd, so the retries are bounded and then the copy fails
+ * ---------------------------------------------------------------------------------------
+ */
+static bool retry( uint32_t *tries ) {
+    if ( ++*tries > SHARED_RETRIES ) {
+        return false;
+    }
+    if ( *tries > SHARED_SPINS ) {
+        sched_yield();
+    }
+    return true;
+}
+
+bool shared_get( const shared_reader_t *reader, uint32_t index, shared_value_t *value ) {
+    const shared_header_t *head = reader->header;
+    const shared_entry_t  *entry;
+    uint32_t              table, seq, tries = 0;
+
+    if ( !head || index >= reader->capacity ) {
+        return false;
+    }
+    entry = &reader->entries[index];
+    do {
+        if ( !retry(&tries) ) {
+            return false;
+        }
+        table = __atomic_load_n(&head->seq, __ATOMIC_ACQUIRE);
+        if ( __atomic_load_n(&head->closed, __ATOMIC_RELAXED) ) {
+            return false;
+        }
+        if ( table & 1 ) {
+            continue;
+        }
+        if ( index >= __atomic_load_n(&head->count, __ATOMIC_RELAXED) ) {
+            return false;
+        }
+        do {
+            if ( !retry(&tries) ) {
+                return false;
+            }
+            seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+            if ( seq & 1 ) {
+                continue;
+            }
+            value->value   = __atomic_load_n(&entry->value,   __ATOMIC_RELAXED);
+            value->quality = __atomic_load_n(&entry->quality, __ATOMIC_RELAXED);
+            value->pin     = __atomic_load_n(&entry->pin,     __ATOMIC_RELAXED);
+            value->time    = __atomic_load_n(&entry->time,    __ATOMIC_RELAXED);
+            memcpy(value->label, (const char*)entry->label, SHARED_LABEL);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ( (seq & 1) || __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) != seq );
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ( (table & 1) || __atomic_load_n(&head->seq, __ATOMIC_RELAXED) != table );
+
+    value->label[SHARED_LABEL-1] = '\0';
+    return true;
+}
+
+int shared_find( const shared_reader_t *reader, const char *label ) {
+    shared_value_t value;
+    uint32_t       count = shared_count(reader);
+
+    for ( uint32_t index=0; index<count; index++ ) {
+        if ( shared_get(reader, index, &value) && !strcmp(value.label, label) ) {
+            return index;
+        }
+    }
+    return -1;
+}
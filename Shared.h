@@ -0,0 +1,114 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Shared_h
+#define Shared_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Last values in POSIX shared memory (/dev/shm<name>), for local processes that want
+ * current readings without going through the broker. The daemon is the only writer,
+ * readers map the segment read-only and never make a system call after attaching.
+ * Every entry is guarded by its own seqlock: its sequence is odd while the daemon
+ * writes it, a reader copies the entry and tries again if the sequence was odd or
+ * changed meanwhile. The header's sequence does the same for the sensor table as a
+ * whole, which only changes when a reload adds, removes or reorders sensors.
+ * A segment that is given up (daemon stopped, table outgrew it) is marked closed and
+ * readers have to attach again.
+ * ---------------------------------------------------------------------------------------
+ */
+#define SHARED_MAGIC     0x5253564cu            /* 'RSVL'                              */
+#define SHARED_VERSION   1
+#define SHARED_LABEL     48                     /* bytes incl. '\0', longer are cut    */
+#define SHARED_HEARTBEAT 1000                   /* msecs, the daemon beats at least   */
+#define SHARED_STALE     5                      /* beats missed until it counts dead  */
+
+typedef struct {
+    uint32_t  magic;
+    uint16_t  version;
+    uint16_t  entry_size;                       /* sizeof(shared_entry_t)              */
+    uint32_t  seq;                              /* sensor table seqlock                */
+    uint32_t  closed;                           /* attach again                        */
+    uint32_t  capacity;                         /* entries the segment has room for    */
+    uint32_t  count;                            /* sensors                             */
+    uint32_t  generation;                       /* sensor table changes                */
+    int32_t   pid;                              /* of the daemon                       */
+    uint64_t  started;                          /* msecs since the epoch               */
+    uint64_t  heartbeat;                        /* msecs since the epoch, last loop    */
+    uint8_t   reserved[16];
+} shared_header_t;                              /* 64 bytes, entries follow            */
+
+typedef struct {
+    uint32_t  seq;                              /* entry seqlock                       */
+    uint16_t  value;
+    uint8_t   quality;                          /* PAYLOAD_* flags                     */
+    uint8_t   pin;
+    uint64_t  time;                             /* msecs since the epoch, 0 = none yet */
+    char      label[SHARED_LABEL];
+} shared_entry_t;                               /* 64 bytes, one cache line            */
+
+typedef struct {
+    char      label[SHARED_LABEL];
+    uint8_t   pin;
+    uint8_t   quality;
+    uint16_t  value;
+    uint64_t  time;                             /* msecs since the epoch, 0 = none yet */
+} shared_value_t;
+
+/* daemon side */
+bool     shared_create( const char *name );
+void     shared_close( void );
+bool     shared_sensors( const shared_value_t *values, uint32_t count );
+void     shared_update( uint32_t index, uint16_t value, uint8_t quality, uint64_t time );
+void     shared_heartbeat( uint64_t time );
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Reader side. Indices from shared_find() stay valid until the sensor table changes,
+ * shared_get() hands back the label to check. Both return false/-1 once the segment is
+ * closed, shared_closed() tells that apart from an unknown label or index. shared_get()
+ * also gives up on an entry a dead writer left halfway through an update.
+ * A daemon that crashed never closes its segment, shared_alive() tells by the heartbeat.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    const shared_header_t  *header;
+    const shared_entry_t   *entries;
+    uint32_t               capacity;
+    size_t                 size;
+} shared_reader_t;
+
+bool     shared_attach( shared_reader_t *reader, const char *name );
+void     shared_detach( shared_reader_t *reader );
+bool     shared_closed( const shared_reader_t *reader );
+uint32_t shared_count( const shared_reader_t *reader );
+int      shared_find( const shared_reader_t *reader, const char *label );
+bool     shared_get( const shared_reader_t *reader, uint32_t index, shared_value_t *value );
+uint64_t shared_heartbeat_time( const shared_reader_t *reader );
+bool     shared_alive( const shared_reader_t *reader, uint64_t now );
+
+#endif /* Shared_h */
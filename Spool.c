@@ -0,0 +1,170 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "Spool.h"
+
+#define SPOOL_MAGIC    0x53435352               /* "RSCS"                              */
+#define SPOOL_VERSION  1
+
+typedef struct {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        capacity;
+    uint32_t        signature;
+    uint32_t        head;                       /* oldest record                       */
+    uint32_t        count;
+    uint32_t        dropped;
+    uint32_t        reserved;
+    spool_record_t  records[];
+} spool_file_t;
+
+static spool_file_t *spool       = NULL;
+static size_t       spool_size   = 0;
+static bool         spool_oldest = true;
+
+bool spool_open( const char *path, uint32_t capacity, uint32_t signature, bool drop_oldest ) {
+    struct stat st;
+    int         fd;
+
+    spool_size   = sizeof(spool_file_t) + (size_t)capacity * sizeof(spool_record_t);
+    spool_oldest = drop_oldest;
+
+    fd = open(path, O_RDWR|O_CREAT, 0600);
+    if ( fd == -1 ) {
+        fprintf(stderr, "Error: open %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    if ( fstat(fd, &st) == -1 || ((size_t)st.st_size != spool_size && ftruncate(fd, spool_size) == -1) ) {
+        fprintf(stderr, "Error: resize %s [%s]\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    spool = mmap(NULL, spool_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( spool == MAP_FAILED ) {
+        fprintf(stderr, "Error: mmap %s [%s]\n", path, strerror(errno));
+        spool = NULL;
+        return false;
+    }
+
+    // start over if the file is new, from another version or another configuration
+    if ( spool->magic     != SPOOL_MAGIC   || spool->version  != SPOOL_VERSION ||
+         spool->capacity  != capacity      || spool->signature != signature    ||
+         spool->head      >= capacity      || spool->count     >  capacity ) {
+        memset(spool, 0, sizeof(spool_file_t));
+        spool->magic     = SPOOL_MAGIC;
+        spool->version   = SPOOL_VERSION;
+        spool->capacity  = capacity;
+        spool->signature = signature;
+    }
+    return true;
+}
+
+void spool_close( void ) {
+    if ( spool ) {
+        msync(spool, spool_size, MS_SYNC);
+        munmap(spool, spool_size);
+        spool = NULL;
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Append a reading. The record is written before the count is bumped, so a crash never
+ * exposes a half written record.
+ * ---------------------------------------------------------------------------------------
+ */
+bool spool_put( const spool_record_t *record ) {
+    if ( !spool || spool->capacity == 0 ) {
+        return false;
+    }
+    if ( spool->count == spool->capacity ) {
+        spool->dropped++;
+        if ( !spool_oldest ) {
+            return false;
+        }
+        spool->head = (spool->head + 1) % spool->capacity;
+        spool->count--;
+    }
+    spool->records[(spool->head + spool->count) % spool->capacity] = *record;
+    spool->count++;
+    return true;
+}
+
+bool spool_peek( spool_record_t *record ) {
+    return spool_peek_at(0, record);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * The reading 'offset' places after the oldest one
+ * ---------------------------------------------------------------------------------------
+ */
+bool spool_peek_at( uint32_t offset, spool_record_t *record ) {
+    if ( !spool || offset >= spool->count ) {
+        return false;
+    }
+    *record = spool->records[(spool->head + offset) % spool->capacity];
+    return true;
+}
+
+void spool_pop( void ) {
+    if ( spool && spool->count ) {
+        spool->head = (spool->head + 1) % spool->capacity;
+        spool->count--;
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * The sensor table changed: map[old index] is the new index of each sensor, readings of
+ * sensors that are gone (or beyond 'count') get SPOOL_NO_SENSOR. The signature is
+ * written last, a crash halfway leaves a spool that no configuration accepts.
+ * ---------------------------------------------------------------------------------------
+ */
+void spool_remap( const uint32_t *map, uint32_t count, uint32_t signature ) {
+    if ( !spool ) {
+        return;
+    }
+    spool->signature = 0;
+    for ( uint32_t n=0; n<spool->count; n++ ) {
+        spool_record_t *record = &spool->records[(spool->head + n) % spool->capacity];
+        record->index = (record->index < count) ? map[record->index] : SPOOL_NO_SENSOR;
+    }
+    spool->signature = signature;
+}
+
+uint32_t spool_count( void ) {
+    return spool ? spool->count : 0;
+}
+
+uint32_t spool_dropped( void ) {
+    return spool ? spool->dropped : 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+
+#ifndef Spool_h
+#define Spool_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Store-and-forward spool: a memory mapped ring buffer file of readings that could not
+ * be published. The file survives restarts as long as the sensor configuration (its
+ * signature) does not change. When full, either the oldest or the newest reading is
+ * dropped.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint64_t  timestamp;                        /* msecs since the epoch               */
+    uint32_t  index;                            /* sensor index                        */
+    uint16_t  value;
+    uint16_t  flags;
+} spool_record_t;
+
+#define SPOOL_NO_SENSOR  UINT32_MAX            /* reading of a sensor no longer there */
+
+bool     spool_open( const char *path, uint32_t capacity, uint32_t signature, bool drop_oldest );
+void     spool_close( void );
+bool     spool_put( const spool_record_t *record );
+bool     spool_peek( spool_record_t *record );
+bool     spool_peek_at( uint32_t offset, spool_record_t *record );
+void     spool_pop( void );
+void     spool_remap( const uint32_t *map, uint32_t count, uint32_t signature );
+uint32_t spool_count( void );
+uint32_t spool_dropped( void );
+
+#endif /* Spool_h */
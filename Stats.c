@@ -0,0 +1,218 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "Stats.h"
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Values below 8 get a bucket each, above that every power of two is split into 8. Values
+ * are clamped to 32 bit, which keeps the table at 240 buckets (~1KB) per histogram.
+ * ---------------------------------------------------------------------------------------
+ */
+#define STATS_SUB_BITS  3
+#define STATS_SUB       (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS   ((32 - STATS_SUB_BITS + 1) * STATS_SUB)
+
+typedef struct {
+    atomic_uint_fast32_t  bucket[STATS_BUCKETS];
+    atomic_uint_fast64_t  count;
+    atomic_uint_fast64_t  sum;
+    atomic_uint_fast64_t  max;
+} stats_histogram_t;
+
+static stats_histogram_t histograms[STATS_HISTOGRAMS];
+
+static const char *names[STATS_HISTOGRAMS] = {
+    "read_digital", "read_dht11", "lateness", "publish", "queue_depth"
+};
+
+static int         listen_fd   = -1;
+static const char  *socket_path = NULL;
+
+uint64_t stats_timestamp( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000LL + ts.tv_nsec/1000;
+}
+
+static int bucket_of( uint32_t value ) {
+    int msb;
+
+    if ( value < STATS_SUB ) {
+        return value;
+    }
+    msb = 31 - __builtin_clz(value);
+    return (msb - STATS_SUB_BITS + 1) * STATS_SUB + ((value >> (msb - STATS_SUB_BITS)) & (STATS_SUB-1));
+}
+
+/*
+ * highest value that falls into bucket
+ */
+static uint64_t bucket_top( int bucket ) {
+    int shift;
+
+    if ( bucket < STATS_SUB ) {
+        return bucket;
+    }
+    shift = bucket / STATS_SUB - 1;
+    return ((uint64_t)(STATS_SUB + bucket % STATS_SUB + 1) << shift) - 1;
+}
+
+void stats_record( stats_id_t id, uint64_t value ) {
+    stats_histogram_t *h = &histograms[id];
+    uint64_t          max;
+
+    if ( value > UINT32_MAX ) {
+        value = UINT32_MAX;
+    }
+    atomic_fetch_add_explicit(&h->bucket[bucket_of(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+
+    max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while ( value > max &&
+            !atomic_compare_exchange_weak_explicit(&h->max, &max, value,
+                                                   memory_order_relaxed, memory_order_relaxed) ) {
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Count, sum, max and percentiles of a histogram. Recording may go on meanwhile, so the
+ * numbers are a close but not an exact snapshot.
+ * ---------------------------------------------------------------------------------------
+ */
+void stats_summary( stats_id_t id, stats_summary_t *summary ) {
+    stats_histogram_t *h = &histograms[id];
+    uint32_t          counts[STATS_BUCKETS];
+    uint64_t          total = 0, seen = 0;
+    uint64_t          *targets[] = { &summary->p50, &summary->p90, &summary->p99, &summary->p999 };
+    double            ranks[]    = { 0.5, 0.9, 0.99, 0.999 };
+    int               next = 0;
+
+    memset(summary, 0, sizeof(*summary));
+    for ( int i=0; i<STATS_BUCKETS; i++ ) {
+        counts[i] = atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+        total    += counts[i];
+    }
+    summary->count = total;
+    summary->sum   = atomic_load_explicit(&h->sum, memory_order_relaxed);
+    summary->max   = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+    for ( int i=0; i<STATS_BUCKETS && next<4; i++ ) {
+        seen += counts[i];
+        while ( next < 4 && seen && seen >= ranks[next] * total ) {
+            uint64_t top = bucket_top(i);
+            *targets[next++] = (top < summary->max) ? top : summary->max;
+        }
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * All histograms as a JSON object member: "histograms":{"<name>":{...},...}
+ * ---------------------------------------------------------------------------------------
+ */
+void stats_print( FILE *fp ) {
+    fprintf(fp, "\"histograms\":{");
+    for ( int id=0; id<STATS_HISTOGRAMS; id++ ) {
+        stats_summary_t s;
+
+        stats_summary(id, &s);
+        fprintf(fp, "%s\"%s\":{\"count\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,"
+                "\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                id ? "," : "", names[id],
+                (unsigned long long)s.count,
+                (unsigned long long)(s.count ? s.sum / s.count : 0),
+                (unsigned long long)s.p50, (unsigned long long)s.p90,
+                (unsigned long long)s.p99, (unsigned long long)s.p999,
+                (unsigned long long)s.max);
+    }
+    fprintf(fp, "}");
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Stats endpoint. The listening socket is non-blocking so a spurious wakeup can't stall
+ * the main loop, clients get a short send timeout for the same reason.
+ * ---------------------------------------------------------------------------------------
+ */
+bool stats_listen( const char *path ) {
+    struct sockaddr_un addr;
+
+    if ( strlen(path) >= sizeof(addr.sun_path) ) {
+        fprintf(stderr, "Error: stats socket path too long: %s\n", path);
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( listen_fd == -1 ) {
+        fprintf(stderr, "Error: socket [%s]\n", strerror(errno));
+        return false;
+    }
+    unlink(path);
+    if ( bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listen_fd, 4) == -1 ) {
+        fprintf(stderr, "Error: stats socket %s [%s]\n", path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    fcntl(listen_fd, F_SETFL, O_NONBLOCK);
+    socket_path = path;
+    return true;
+}
+
+void stats_close( void ) {
+    if ( listen_fd != -1 ) {
+        close(listen_fd);
+        unlink(socket_path);
+        listen_fd = -1;
+    }
+}
+
+int stats_fd( void ) {
+    return listen_fd;
+}
+
+int stats_accept( void ) {
+    struct timeval timeout = { 0, 100000 };
+    int            fd;
+
+    if ( listen_fd == -1 || (fd = accept(listen_fd, NULL, NULL)) == -1 ) {
+        return -1;
+    }
+    fcntl(fd, F_SETFL, 0);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
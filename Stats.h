@@ -0,0 +1,73 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ReadDHT11.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#ifndef Stats_h
+#define Stats_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Always-on instrumentation. Each histogram is log-linear (HDR style): 8 sub-buckets per
+ * power of two, so any value is off by at most 12.5%. stats_record() is a handful of
+ * relaxed atomic adds, it takes no locks and may be called from any thread.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef enum {
+    STATS_READ_DIGITAL,                     /* usec for one gpio_read()                  */
+    STATS_READ_DHT11,                       /* usec for one DHT11 transaction            */
+    STATS_LATENESS,                         /* usec a scheduled read ran after its time  */
+    STATS_PUBLISH,                          /* usec mqtt_publish() -> handed to mosquitto*/
+    STATS_QUEUE_DEPTH,                      /* messages waiting, sampled on every enqueue*/
+    STATS_HISTOGRAMS
+} stats_id_t;
+
+typedef struct {
+    uint64_t  count;
+    uint64_t  sum;
+    uint64_t  max;
+    uint64_t  p50;
+    uint64_t  p90;
+    uint64_t  p99;
+    uint64_t  p999;
+} stats_summary_t;
+
+void     stats_record( stats_id_t id, uint64_t value );
+void     stats_summary( stats_id_t id, stats_summary_t *summary );
+void     stats_print( FILE *fp );
+uint64_t stats_timestamp( void );
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Local stats endpoint, a listening UNIX stream socket. The owner polls stats_fd() and
+ * writes a report to every client stats_accept() returns.
+ * ---------------------------------------------------------------------------------------
+ */
+bool     stats_listen( const char *path );
+void     stats_close( void );
+int      stats_fd( void );
+int      stats_accept( void );
+
+#endif /* Stats_h */
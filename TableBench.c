@@ -0,0 +1,365 @@
+/*
+ * ---------------------------------------------------------------------------------------
+ * Copyright 2017 by Bodo Bauer <bb@bb-zone.com>
+ *
+ * This file is part of the RPI Sensor Client 'RPISensorClient'
+ *
+ * PRISensorClient is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PRISensorClient is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with RPISensorClient.  If not, see <http://www.gnu.org/licenses/>.
+ * ---------------------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Sensor table benchmark: the cost of the passes over the sensor table, with sensor_t as
+ * it was before the hot/cold split (one struct per sensor) against the split table of
+ * Sensors.h. Reported per sensor count, in nsecs:
+ *   scan     per sensor, find the earliest due time and count the sensors that are due
+ *   update   per sensor, full report: compare the last value and store a new one
+ *   lookup   per edge event, find the sensors on the event's pin (a scan of the whole
+ *            table before, the per pin chain now)
+ *   poll     per read, the way the main loop goes through the table: take the next due
+ *            sensor off the deadline heap, look at its polling parameters and put it back
+ *            with the next due time. Before, the parameters were part of sensor_t (the
+ *            heap hands out sensors in no particular order, one cache miss each), now
+ *            they are packed in sensor_table_t.poll.
+ * ---------------------------------------------------------------------------------------
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Sensors.h"
+#include "Scheduler.h"
+
+#define BENCH_WORK   (64*1024*1024)             /* sensor visits per measurement       */
+#define BENCH_PINS   54                         /* GPIO lines of the BCM2835           */
+#define BENCH_TICK   10000                      /* usec the clock moves per poll pass  */
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * sensor_t before the split
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    uint8_t       pin;
+    sensorType_t  type;
+    uint32_t      freq;
+    char          *label;
+    bool          invert;
+    bool          edge;
+    bool          batched;
+    uint16_t      value;
+    uint64_t      next_read;
+    uint64_t      last_sample;
+    uint32_t      reads;
+    uint32_t      read_max;
+    uint32_t      late_max;
+    char          *topic;
+    size_t        topic_length;
+    char          *json;
+    size_t        json_length;
+} legacySensor_t;
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * sensor_t with the polling parameters still in it
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct {
+    sensor_t      meta;
+    sensor_poll_t poll;
+} coldSensor_t;
+
+volatile uint64_t sink;                         /* keeps results from being optimized  */
+
+uint64_t bench_timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * The passes, once for each layout
+ * ---------------------------------------------------------------------------------------
+ */
+uint64_t scanLegacy(legacySensor_t *list, size_t count, uint64_t now) {
+    uint64_t next = (uint64_t)-1, due = 0;
+
+    for ( size_t index=0; index<count; index++ ) {
+        if ( list[index].next_read < next ) {
+            next = list[index].next_read;
+        }
+        due += list[index].next_read <= now;
+    }
+    return next + due;
+}
+
+uint64_t scanTable(sensor_table_t *table, uint64_t now) {
+    uint64_t next = (uint64_t)-1, due = 0;
+
+    for ( size_t index=0; index<table->count; index++ ) {
+        if ( table->next_read[index] < next ) {
+            next = table->next_read[index];
+        }
+        due += table->next_read[index] <= now;
+    }
+    return next + due;
+}
+
+uint64_t updateLegacy(legacySensor_t *list, size_t count, uint16_t value) {
+    uint64_t changed = 0;
+
+    for ( size_t index=0; index<count; index++ ) {
+        if ( list[index].value != value ) {
+            list[index].value = value;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+uint64_t updateTable(sensor_table_t *table, uint16_t value) {
+    uint64_t changed = 0;
+
+    for ( size_t index=0; index<table->count; index++ ) {
+        if ( table->value[index] != value ) {
+            table->value[index] = value;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+uint64_t lookupLegacy(legacySensor_t *list, size_t count, uint8_t pin) {
+    uint64_t found = 0;
+
+    for ( size_t index=0; index<count; index++ ) {
+        if ( list[index].edge && list[index].pin == pin ) {
+            found += list[index].value;
+        }
+    }
+    return found;
+}
+
+uint64_t lookupTable(sensor_table_t *table, uint8_t pin) {
+    uint64_t found = 0;
+
+    for ( uint32_t index=table->pin_first[pin]; index!=SENSOR_NONE; index=table->pin_next[index] ) {
+        if ( table->poll[index].edge ) {
+            found += table->value[index];
+        }
+    }
+    return found;
+}
+
+uint64_t pollCold(coldSensor_t *list, uint64_t *next_read, scheduler_t *sched, uint64_t now) {
+    uint64_t reads = 0;
+    uint32_t index;
+
+    while ( sched_pop_due(sched, now, &index) ) {
+        sensor_poll_t *poll = &list[index].poll;
+
+        if ( !poll->edge ) {
+            next_read[index] += (uint64_t)poll->period * 1000;
+            sched_push_slack(sched, next_read[index], poll->tolerance, index);
+        }
+        reads++;
+    }
+    return reads;
+}
+
+uint64_t pollTable(sensor_table_t *table, scheduler_t *sched, uint64_t now) {
+    uint64_t reads = 0;
+    uint32_t index;
+
+    while ( sched_pop_due(sched, now, &index) ) {
+        sensor_poll_t *poll = &table->poll[index];
+
+        if ( !poll->edge ) {
+            table->next_read[index] += (uint64_t)poll->period * 1000;
+            sched_push_slack(sched, table->next_read[index], poll->tolerance, index);
+        }
+        reads++;
+    }
+    return reads;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Both tables with 'count' sensors spread over the pins, due times spread over a second
+ * ---------------------------------------------------------------------------------------
+ */
+bool fillTables(legacySensor_t **list, sensor_table_t *table, size_t count) {
+    *list = calloc(count, sizeof(legacySensor_t));
+    sensors_init(table);
+    if ( !*list ) {
+        return false;
+    }
+    for ( size_t index=0; index<count; index++ ) {
+        sensor_t *sensor = sensors_add(table);
+        uint64_t due     = (index * 7919) % 1000000;
+
+        if ( !sensor ) {
+            return false;
+        }
+        sensor->pin               = (*list)[index].pin  = index % BENCH_PINS;
+        table->poll[index].freq   = (*list)[index].freq = 100;
+        table->poll[index].edge   = (*list)[index].edge = true;
+        table->next_read[index]   = (*list)[index].next_read = due;
+    }
+    sensors_compile(table);
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * Polled sensors read every 10 msecs to 1 sec for the poll pass, the same parameters in
+ * both layouts, each table on its own deadline heap
+ * ---------------------------------------------------------------------------------------
+ */
+bool fillPolls(coldSensor_t **list, uint64_t **next_read, scheduler_t *sched_cold,
+               sensor_table_t *table, scheduler_t *sched, size_t count) {
+    *list      = calloc(count, sizeof(coldSensor_t));
+    *next_read = calloc(count, sizeof(uint64_t));
+    if ( !*list || !*next_read || !sched_init(sched_cold, count) || !sched_init(sched, count) ) {
+        return false;
+    }
+    for ( size_t index=0; index<count; index++ ) {
+        sensor_poll_t poll = { 0 };
+
+        poll.freq      = poll.period = 10 + (index * 7919) % 991;
+        poll.tolerance = 1000;
+        (*list)[index].poll = table->poll[index] = poll;
+        (*next_read)[index] = table->next_read[index] = (index * 104729) % (poll.period * 1000);
+        sched_push_slack(sched_cold, (*next_read)[index], poll.tolerance, index);
+        sched_push_slack(sched, table->next_read[index], poll.tolerance, index);
+    }
+    return true;
+}
+
+void runBench(size_t count) {
+    legacySensor_t *list;
+    coldSensor_t   *cold;
+    uint64_t       *next_read;
+    sensor_table_t table;
+    scheduler_t    sched_cold, sched;
+    size_t         rounds  = BENCH_WORK / count;
+    size_t         events  = rounds < 1024 ? 1024 : rounds;
+    size_t         ticks   = rounds / 4 < 400 ? 400 : rounds / 4;
+    uint64_t       reads[2] = { 0, 0 };
+    double         nsecs[8];
+    uint64_t       start;
+
+    if ( !fillTables(&list, &table, count) ) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = bench_timestamp();
+    for ( size_t round=0; round<rounds; round++ ) {
+        sink += scanLegacy(list, count, round * 1000);
+    }
+    nsecs[0] = (double)(bench_timestamp() - start) / rounds / count;
+    start = bench_timestamp();
+    for ( size_t round=0; round<rounds; round++ ) {
+        sink += scanTable(&table, round * 1000);
+    }
+    nsecs[1] = (double)(bench_timestamp() - start) / rounds / count;
+
+    start = bench_timestamp();
+    for ( size_t round=0; round<rounds; round++ ) {
+        sink += updateLegacy(list, count, round & 1);
+    }
+    nsecs[2] = (double)(bench_timestamp() - start) / rounds / count;
+    start = bench_timestamp();
+    for ( size_t round=0; round<rounds; round++ ) {
+        sink += updateTable(&table, round & 1);
+    }
+    nsecs[3] = (double)(bench_timestamp() - start) / rounds / count;
+
+    start = bench_timestamp();
+    for ( size_t event=0; event<events; event++ ) {
+        sink += lookupLegacy(list, count, event % BENCH_PINS);
+    }
+    nsecs[4] = (double)(bench_timestamp() - start) / events;
+    start = bench_timestamp();
+    for ( size_t event=0; event<events; event++ ) {
+        sink += lookupTable(&table, event % BENCH_PINS);
+    }
+    nsecs[5] = (double)(bench_timestamp() - start) / events;
+
+    if ( !fillPolls(&cold, &next_read, &sched_cold, &table, &sched, count) ) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    start = bench_timestamp();
+    for ( size_t tick=0; tick<ticks; tick++ ) {
+        reads[0] += pollCold(cold, next_read, &sched_cold, tick * BENCH_TICK);
+    }
+    nsecs[6] = (double)(bench_timestamp() - start) / (reads[0] ? reads[0] : 1);
+    start = bench_timestamp();
+    for ( size_t tick=0; tick<ticks; tick++ ) {
+        reads[1] += pollTable(&table, &sched, tick * BENCH_TICK);
+    }
+    nsecs[7] = (double)(bench_timestamp() - start) / (reads[1] ? reads[1] : 1);
+
+    printf("%7zu %9.2f %9.2f %9.2f %9.2f %11.0f %11.0f %9.1f %9.1f\n", count,
+           nsecs[0], nsecs[1], nsecs[2], nsecs[3], nsecs[4], nsecs[5], nsecs[6], nsecs[7]);
+    fflush(stdout);
+    free(list);
+    free(cold);
+    free(next_read);
+    sched_free(&sched_cold);
+    sched_free(&sched);
+    sensors_free(&table);
+}
+
+/*
+ * ---------------------------------------------------------------------------------------
+ * M A I N
+ * ---------------------------------------------------------------------------------------
+ */
+int main(int argc, char *argv[]) {
+    size_t counts[32] = { 32, 1024, 65536 };
+    int    num_counts = 0;
+
+    for ( int i=1; i<argc && num_counts<32; i++ ) {
+        counts[num_counts++] = strtoul(argv[i], NULL, 10);
+    }
+    if ( num_counts == 0 ) {
+        num_counts = 3;
+    }
+
+    printf("Sensor table, %zu bytes per sensor before, %zu hot + %zu cold bytes now\n",
+           sizeof(legacySensor_t), 2*sizeof(uint64_t) + sizeof(uint16_t) + sizeof(bool) + sizeof(sensor_poll_t),
+           sizeof(sensor_t) + sizeof(uint32_t));
+    printf("%7s %9s %9s %9s %9s %11s %11s %9s %9s\n", "", "scan", "", "update", "", "lookup", "", "poll", "");
+    printf("%7s %9s %9s %9s %9s %11s %11s %9s %9s\n", "sensors", "before", "now", "before", "now", "before", "now",
+           "before", "now");
+    printf("%7s %9s %9s %9s %9s %11s %11s %9s %9s\n", "", "ns/sens", "ns/sens", "ns/sens", "ns/sens", "ns/event", "ns/event",
+           "ns/read", "ns/read");
+
+    for ( int i=0; i<num_counts; i++ ) {
+        if ( counts[i] ) {
+            runBench(counts[i]);
+        }
+    }
+    return 0;
+}